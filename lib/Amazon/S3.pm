@@ -8,12 +8,12 @@ use HTTP::Date;
 use MIME::Base64 qw(encode_base64);
 use Amazon::S3::Bucket;
 use LWP::UserAgent::Determined;
-use URI::Escape qw(uri_escape_utf8);
+use URI::Escape qw(uri_escape_utf8 uri_unescape);
 use XML::Simple;
 
 use base qw(Class::Accessor::Fast);
 __PACKAGE__->mk_accessors(
-    qw(aws_access_key_id aws_secret_access_key secure ua err errstr timeout retry host)
+    qw(aws_access_key_id aws_secret_access_key secure ua err errstr timeout retry host dns_bucket_names)
 );
 our $VERSION = '0.45';
 
@@ -31,6 +31,7 @@ sub new {
     $self->secure(0)                if not defined $self->secure;
     $self->timeout(30)              if not defined $self->timeout;
     $self->host('s3.amazonaws.com') if not defined $self->host;
+    $self->dns_bucket_names(1)      if not defined $self->dns_bucket_names;
 
     my $ua;
     if ($self->retry) {
@@ -264,7 +265,7 @@ sub _make_request {
     my $protocol = $self->secure ? 'https' : 'http';
     my $host     = $self->host;
     my $url      = "$protocol://$host/$path";
-    if ($path =~ m{^([^/?]+)(.*)} && _is_dns_bucket($1)) {
+    if ($self->dns_bucket_names && $path =~ m{^([^/?]+)(.*)} && _is_dns_bucket($1)) {
         $url = "$protocol://$1.$host$2";
     }
 
@@ -469,15 +470,14 @@ sub _canonical_string {
     $path =~ /^([^?]*)/;
     $buf .= "/$1";
 
-    # ...unless there is an acl or torrent parameter
-    if ($path =~ /[&?]acl($|=|&)/) {
-        $buf .= '?acl';
-    }
-    elsif ($path =~ /[&?]torrent($|=|&)/) {
-        $buf .= '?torrent';
-    }
-    elsif ($path =~ /[&?]location($|=|&)/) {
-        $buf .= '?location';
+    # ...unless there are sub-resource parameters, which are signed sorted and
+    # unescaped
+    if ($path =~ /\?(.*)$/) {
+        my @subresources =
+          sort grep { /^(acl|torrent|location|uploads|uploadId|partNumber)($|=)/ }
+          split /&/, $1;
+        $buf .= '?' . join('&', map { uri_unescape($_) } @subresources)
+          if @subresources;
     }
 
     return $buf;
@@ -657,6 +657,12 @@ retries.
 Defines the S3 host endpoint to use. Defaults to
 's3.amazonaws.com'.
 
+=item dns_bucket_names
+
+Address buckets as C<bucket.host> when the bucket name allows it.
+Defaults to on. Turn it off to use C<host/bucket> paths, as most
+S3-compatible servers running on localhost require.
+
 =back
 
 =head2 buckets
@@ -4,6 +4,9 @@ use warnings;
 use Carp;
 use File::stat;
 use IO::File;
+use Digest::MD5 qw(md5);
+use MIME::Base64 qw(encode_base64);
+use XML::Simple;
 
 use base qw(Class::Accessor::Fast);
 __PACKAGE__->mk_accessors(qw(bucket creation_date account));
@@ -193,6 +196,132 @@ sub get_location_constraint {
     return $lc;
 }
 
+# returns the upload id, or undef on failure
+sub initiate_multipart_upload {
+    my ($self, $key, $conf) = @_;
+    croak 'must specify key' unless $key && length $key;
+    my $acct = $self->account;
+
+    my $request =
+      $acct->_make_request('POST', $self->_uri($key) . '?uploads', $conf || {});
+    my $response = $acct->_do_http($request);
+    unless ($response->code =~ /^2\d\d$/) {
+        $acct->_remember_errors($response->content);
+        return undef;
+    }
+
+    my $r = $acct->_xpc_of_content($response->content);
+    return $r->{UploadId};
+}
+
+# returns the part's etag, or undef on failure
+sub upload_part {
+    my ($self, $key, $upload_id, $part_number, $data) = @_;
+    croak 'must specify key' unless $key && length $key;
+    my $acct = $self->account;
+
+    my $md5  = md5($data);
+    my $conf = {
+        'Content-Length' => length $data,
+        'Content-MD5'    => encode_base64($md5, ''),
+    };
+    my $path =
+        $self->_uri($key)
+      . "?partNumber=$part_number&uploadId="
+      . $acct->_urlencode($upload_id);
+
+    my $request = $acct->_make_request('PUT', $path, $conf, $data);
+    my $response = $acct->_do_http($request);
+    unless ($response->code =~ /^2\d\d$/) {
+        $acct->_remember_errors($response->content);
+        return undef;
+    }
+
+    my $etag = _unquote($response->header('ETag'));
+    if (lc $etag ne unpack('H*', $md5)) {
+        $acct->err('BadDigest');
+        $acct->errstr("part $part_number etag $etag does not match its md5");
+        return undef;
+    }
+    return $etag;
+}
+
+# returns a hashref of part number => etag, or undef if the upload is unknown
+sub list_parts {
+    my ($self, $key, $upload_id) = @_;
+    my $acct = $self->account;
+
+    my %parts;
+    my $marker = 0;
+    while (1) {
+        my $path =
+            $self->_uri($key)
+          . '?uploadId='
+          . $acct->_urlencode($upload_id)
+          . "&part-number-marker=$marker";
+        my $request = $acct->_make_request('GET', $path, {});
+        my $response = $acct->_do_http($request);
+        unless ($response->code =~ /^2\d\d$/) {
+            $acct->_remember_errors($response->content);
+            return undef;
+        }
+
+        my $r = XMLin($response->content,
+            'SuppressEmpty' => '',
+            'ForceArray'    => ['Part']);
+        foreach my $part (@{$r->{Part} || []}) {
+            $parts{$part->{PartNumber}} = _unquote($part->{ETag});
+        }
+        last unless $r->{IsTruncated} && $r->{IsTruncated} eq 'true';
+        $marker = $r->{NextPartNumberMarker};
+    }
+    return \%parts;
+}
+
+# returns the etag of the assembled object, or undef on failure
+sub complete_multipart_upload {
+    my ($self, $key, $upload_id, $parts) = @_;
+    my $acct = $self->account;
+
+    my $xml = "<CompleteMultipartUpload>";
+    foreach my $n (sort { $a <=> $b } keys %$parts) {
+        $xml .= "<Part><PartNumber>$n</PartNumber>"
+          . "<ETag>\"$parts->{$n}\"</ETag></Part>";
+    }
+    $xml .= "</CompleteMultipartUpload>";
+
+    my $path = $self->_uri($key) . '?uploadId=' . $acct->_urlencode($upload_id);
+    my $request = $acct->_make_request('POST', $path,
+        {'Content-Length' => length $xml}, $xml);
+    my $response = $acct->_do_http($request);
+
+    # S3 can report a failure with a 200 status once it has started assembling
+    my $content = $response->content;
+    if ($response->code !~ /^2\d\d$/ || $content =~ /<Error>/) {
+        $acct->_remember_errors($content);
+        return undef;
+    }
+
+    my $r = $acct->_xpc_of_content($content);
+    return _unquote($r->{ETag});
+}
+
+# returns bool
+sub abort_multipart_upload {
+    my ($self, $key, $upload_id) = @_;
+    my $acct = $self->account;
+    return $acct->_send_request_expect_nothing('DELETE',
+        $self->_uri($key) . '?uploadId=' . $acct->_urlencode($upload_id), {});
+}
+
+sub _unquote {
+    my $etag = shift;
+    return '' unless defined $etag;
+    $etag =~ s/^"//;
+    $etag =~ s/"$//;
+    return $etag;
+}
+
 # proxy up the err requests
 
 sub err { $_[0]->account->err }
@@ -483,6 +612,35 @@ Returns the location constraint data on a bucket.
 For more information on location constraints, refer to the
 Amazon S3 Developer Guide.
 
+=head2 initiate_multipart_upload $key_name, [$conf]
+
+Starts a multipart upload of the resource and returns its upload id,
+or undef on failure. C<$conf> is a HASHREF of headers as for
+C<add_key>.
+
+=head2 upload_part $key_name, $upload_id, $part_number, $data
+
+Uploads one part (1 to 10000; every part but the last must be at
+least 5MB). The part is sent with a Content-MD5 header so that S3
+rejects it if it is damaged in transit, and the returned etag is
+checked against the same digest. Returns the etag, or undef on
+failure.
+
+=head2 list_parts $key_name, $upload_id
+
+Returns a HASHREF of part number to etag for the parts of an
+unfinished upload that S3 already holds, or undef if the upload
+no longer exists. Use this to resume an interrupted upload.
+
+=head2 complete_multipart_upload $key_name, $upload_id, $parts
+
+Assembles the parts given as a HASHREF of part number to etag and
+returns the etag of the resulting resource, or undef on failure.
+
+=head2 abort_multipart_upload $key_name, $upload_id
+
+Discards an unfinished upload and the parts uploaded so far.
+
 =head2 err
 
 The S3 error code for the last error the account encountered.
@@ -93,6 +93,14 @@
 #include "stdarg.h"
 // MODULE includes:
 #include "mainutil.h"
+#include "zlabframe.h"
+#include "zlabplugins.h"
+#include "zlabassets.h"
+#include "zlabcapture.h"
+#include "zlabmemtrack.h"
+#include "zlabsampler.h"
+#include "zlabglstate.h"
+#include "zlablatency.h"
 // ZBSLIB includes:
 #include "zcmdparse.h" 
 #include "zhashtable.h"
@@ -125,8 +133,8 @@
 char exeName[255] = {0,};
 
 // PLUGIN
-char curPlugin[64] = {0,};
-char newPlugin[64] = {0,};
+char curPlugin[ZLAB_PLUGIN_NAME_MAX] = {0,};
+char newPlugin[ZLAB_PLUGIN_NAME_MAX] = {0,};
 char *startupPlugin = 0;
 
 // OPTIONS
@@ -160,74 +168,189 @@ ZMSG_HANDLER( SetVar ) {
 	}
 }
 
+// Path helpers
+//===============================================================================
+
+char * zlabPathJoinR( char *dir, char *file, char *buf, int bufLen ) {
+	// Join dir and file with a single '/', standardizing any backslashes to '/'.
+	// Returns buf, or 0 if the result would not fit.
+	int dirLen = dir ? (int)strlen( dir ) : 0;
+	int fileLen = file ? (int)strlen( file ) : 0;
+	if( dirLen + 1 + fileLen + 1 > bufLen ) {
+		return 0;
+	}
+	int len = 0;
+	if( dirLen ) {
+		memcpy( buf, dir, dirLen );
+		len = dirLen;
+		if( fileLen && buf[len-1] != '/' && buf[len-1] != '\\' ) {
+			buf[len++] = '/';
+		}
+	}
+	memcpy( buf + len, file, fileLen );
+	len += fileLen;
+	buf[len] = 0;
+	for( char *c = buf; *c; c++ ) {
+		if( *c == '\\' ) {
+			*c = '/';
+		}
+	}
+	return buf;
+}
+
 // User local path determination
 //===============================================================================
-char * getUserLocalAppFolder() {
-	// Return the path to a folder that is writeable and preferably unique by user.
-	static char filepath[512];
 
+char * getUserLocalAppFolderR( char *buf, int bufLen ) {
+	// Return the path to a folder that is writeable and preferably unique by user.
+	// No file system access; see getUserLocalFilespecR() for creating it.
+	char *folder = options.getS( "userLocalFolder", 0 );
+	if( folder && *folder ) {
+		if( strlen( folder ) + 1 > (size_t)bufLen ) {
+			return 0;
+		}
+		strcpy( buf, folder );
+		return buf;
+	}
 	if( !options.getI( "ignoreUserLocal" ) ) {
+		char *plugin = curPlugin[0] ? curPlugin : startupPlugin;
 		char *appdata = 0;
-		char slash[3];
+		char *slash;
 		#ifdef WIN32
-			strcpy( slash, "\\" );
+			slash = "\\";
 			appdata = getenv( "APPDATA" );
 				// Could use API like SHGetFolderName.
 		#else
-			strcpy( slash, "/." );
+			slash = "/.";
 			appdata = getenv( "HOME" );
 		#endif
-		if( appdata && *appdata ) {
-			strncpy( filepath, appdata, 255 );
-			filepath[255] = 0;
-			if( curPlugin[0] ) {
-				strcat( filepath, ZTmpStr( "%s%s", slash, curPlugin ).s );
-				return filepath;
-			}
-			else if( startupPlugin ) {
-				strcat( filepath, ZTmpStr( "%s%s", slash, startupPlugin ).s );
-				return filepath;
+		if( appdata && *appdata && plugin && *plugin ) {
+			if( strlen( appdata ) + strlen( slash ) + strlen( plugin ) + 1 > (size_t)bufLen ) {
+				return 0;
 			}
+			strcpy( buf, appdata );
+			strcat( buf, slash );
+			strcat( buf, plugin );
+			return buf;
 		}
 	}
 
 	// If we get here, no specific path was found.  Use current.
-	filepath[0] = '.';
-	filepath[1] = 0;
+	if( bufLen < 2 ) {
+		return 0;
+	}
+	buf[0] = '.';
+	buf[1] = 0;
+	return buf;
+}
+
+char * getUserLocalAppFolder() {
+	// The folder is named for the plugin, so the result is cached until the
+	// plugin (or the ignoreUserLocal option) changes.  Main thread only.
+	static char filepath[512];
+	static char cachedPlugin[ZLAB_PLUGIN_NAME_MAX] = {0,};
+	static int cachedIgnoreUserLocal = -1;
+
+	int ignoreUserLocal = options.getI( "ignoreUserLocal" );
+	char *plugin = curPlugin[0] ? curPlugin : ( startupPlugin ? startupPlugin : (char *)"" );
+	if( ignoreUserLocal == cachedIgnoreUserLocal && !strcmp( plugin, cachedPlugin ) ) {
+		return filepath;
+	}
+	cachedIgnoreUserLocal = ignoreUserLocal;
+	strncpy( cachedPlugin, plugin, ZLAB_PLUGIN_NAME_MAX-1 );
+	cachedPlugin[ZLAB_PLUGIN_NAME_MAX-1] = 0;
+
+	if( !getUserLocalAppFolderR( filepath, sizeof(filepath) ) ) {
+		strcpy( filepath, "." );
+	}
 	return filepath;
 }
 
-char * getUserLocalFilespec( char *basename, int bMustExist ) {
-	// bMustExist means that the file *must* already exist; the userLocal
-	// folder will be checked first, and then the current folder, and NULL
-	// will be returned if the file does not exist.
+#ifdef ZMSG_MULTITHREAD
+static PMutex userLocalMutex;
+#endif
+static char userLocalFolderReady[512] = {0,};
+	// the last folder that was checked for / created
 
-	static char userLocalFilename[255];
-	char *appdata = getUserLocalAppFolder();
-	if( appdata && *appdata ) {
-		if( !zWildcardFileExists( appdata ) ) {
+static void userLocalFolderCreate( char *folder ) {
+	#ifdef ZMSG_MULTITHREAD
+		userLocalMutex.lock();
+	#endif
+	if( strcmp( folder, userLocalFolderReady ) ) {
+		if( !zWildcardFileExists( folder ) ) {
 			#ifdef WIN32
-				mkdir( appdata );
+				mkdir( folder );
 			#else
-				mkdir( appdata, 0777 );
+				mkdir( folder, 0777 );
 			#endif
 		}
-		ZFileSpec fs( ZTmpStr( "%s/%s", getUserLocalAppFolder(), basename ) );
-			// this is to make use of the standardize-slash functionality
-		strcpy( userLocalFilename, fs.get() );
-		if( zWildcardFileExists( userLocalFilename ) || !bMustExist ) {
-			return userLocalFilename;
+		strncpy( userLocalFolderReady, folder, sizeof(userLocalFolderReady)-1 );
+	}
+	#ifdef ZMSG_MULTITHREAD
+		userLocalMutex.unlock();
+	#endif
+}
+
+static void userLocalFolderRestore( char *filespec ) {
+	// The folder holding filespec may have been removed since it was
+	// created; forget that it was and create it again
+	char folder[512];
+	if( strlen( filespec ) + 1 > sizeof(folder) ) {
+		return;
+	}
+	strcpy( folder, filespec );
+	char *slash = strrchr( folder, '/' );
+	if( !slash || slash == folder ) {
+		return;
+	}
+	*slash = 0;
+	#ifdef ZMSG_MULTITHREAD
+		userLocalMutex.lock();
+	#endif
+	userLocalFolderReady[0] = 0;
+	#ifdef ZMSG_MULTITHREAD
+		userLocalMutex.unlock();
+	#endif
+	userLocalFolderCreate( folder );
+}
+
+char * getUserLocalFilespecR( char *basename, int bMustExist, char *buf, int bufLen ) {
+	// bMustExist means that the file *must* already exist; the userLocal
+	// folder will be checked first, and then the current folder, and NULL
+	// will be returned if the file does not exist.
+
+	char folder[512];
+	if( getUserLocalAppFolderR( folder, sizeof(folder) ) && *folder ) {
+		userLocalFolderCreate( folder );
+		if( zlabPathJoinR( folder, basename, buf, bufLen ) ) {
+			if( !bMustExist || zWildcardFileExists( buf ) ) {
+				return buf;
+			}
 		}
 	}
 	// If we get here, try the local execution folder for a path
-	strcpy( userLocalFilename, basename );
-	if( zWildcardFileExists( userLocalFilename ) || !bMustExist ) {
-		return userLocalFilename;
+	if( strlen( basename ) + 1 > (size_t)bufLen ) {
+		return 0;
+	}
+	strcpy( buf, basename );
+	if( !bMustExist || zWildcardFileExists( buf ) ) {
+		return buf;
 	}
 	assert( bMustExist );
 	return 0;
 }
 
+char * getUserLocalFilespec( char *basename, int bMustExist ) {
+	static char userLocalFilename[512];
+	char *spec = getUserLocalFilespecR( basename, bMustExist, userLocalFilename, sizeof(userLocalFilename) );
+	if( !spec && !bMustExist ) {
+		// Too long for the buffer; callers that don't require the file
+		// to exist expect a path, so use the basename in the current folder.
+		return basename;
+	}
+	return spec;
+}
+
 // Trace	
 //===============================================================================
 #ifdef ZMSG_MULTITHREAD
@@ -270,7 +393,9 @@ void trace( char *fmt, ... ) {
 		traceMutex.lock();
 	#endif
 	if( !traceFile ) {
-		traceFile = fopen( getUserLocalFilespec( "trace.txt", 0 ), "wt" );
+		char traceFilename[512];
+		char *traceSpec = getUserLocalFilespecR( "trace.txt", 0, traceFilename, sizeof(traceFilename) );
+		traceFile = traceSpec ? fopen( traceSpec, "wt" ) : 0;
 		static int printFailure = 1;
 		if( !traceFile && printFailure ) {
 			printf( "failed to open trace.txt!\n" );
@@ -281,11 +406,15 @@ void trace( char *fmt, ... ) {
 
 	assert(fmt);
 
-	static char buffer[2048];
+	char buffer[2048];
 	va_list argptr;
 	va_start( argptr, fmt );
 
-	vsprintf(buffer,fmt,argptr);
+	#ifdef WIN32
+		_vsnprintf(buffer,sizeof(buffer),fmt,argptr);
+	#else
+		vsnprintf(buffer,sizeof(buffer),fmt,argptr);
+	#endif
 	buffer[sizeof(buffer)-1]=0;
   	va_end(argptr);
 
@@ -365,30 +494,54 @@ void findFolders( char *argv0 ) {
 
 //===============================================================================
 
+char * zlabCorePathR( char *file, char *buf, int bufLen ) {
+	return zlabPathJoinR( zlabCoreFolder, file, buf, bufLen );
+}
+
 char * zlabCorePath(  char *file ) {
-	static char path[256];
-	strcpy( path, zFileSpecMake( FS_DIR, zlabCoreFolder, FS_FILE, file, FS_END ) );
+	static char path[512];
+	path[0] = 0;
+	if( !zlabCorePathR( file, path, sizeof(path) ) ) {
+		assert( !"zlabCorePath too long" );
+		path[0] = 0;
+	}
 	return path;
 }
 
 //===============================================================================
 
-char * pluginPathVariable( ) {
+char * pluginPathVariableR( char *buf, int bufLen ) {
 // Get the variable that is used to store the plugin path.
-	static char variable[256];
-	strcpy (variable, "pluginPath_");
-	strcat (variable, curPlugin);
-	return variable;
+	if( sizeof("pluginPath_") + strlen( curPlugin ) > (size_t)bufLen ) {
+		return 0;
+	}
+	strcpy (buf, "pluginPath_");
+	strcat (buf, curPlugin);
+	return buf;
+}
+
+char * pluginPathVariable( ) {
+	static char variable[sizeof("pluginPath_") + ZLAB_PLUGIN_NAME_MAX];
+	return pluginPathVariableR( variable, sizeof(variable) );
 }
 
 //===============================================================================
 
-char * pluginPath( char *file ) {
-	static char path[256];
-	char *currentPlugPath = options.getS( pluginPathVariable( ), 0 );
+char * pluginPathR( char *file, char *buf, int bufLen ) {
+	char variable[sizeof("pluginPath_") + ZLAB_PLUGIN_NAME_MAX];
+	char *currentPlugPath = options.getS( pluginPathVariableR( variable, sizeof(variable) ), 0 );
 	assert( currentPlugPath && "Current plugin path is not set!" );
 
-	strcpy( path, zFileSpecMake( FS_DIR, currentPlugPath, FS_FILE, file, FS_END ) );
+	return zlabPathJoinR( currentPlugPath, file, buf, bufLen );
+}
+
+char * pluginPath( char *file ) {
+	static char path[512];
+	path[0] = 0;
+	if( !pluginPathR( file, path, sizeof(path) ) ) {
+		assert( !"pluginPath too long" );
+		path[0] = 0;
+	}
 	return path;
 }
 
@@ -450,6 +603,150 @@ void initCwd( char* argv0, char* mainZUIFile ) {
 }
 */
 
+// Position persistence
+//===============================================================================
+// Window and console positions are saved after they have stopped changing for
+// POSITION_WRITE_DELAY seconds, so dragging or resizing the window doesn't do
+// file I/O every frame.  With ZMSG_MULTITHREAD the files are written by a
+// background thread; otherwise positionFilesMaintain() writes them directly.
+// The file is resolved when a position is first recorded, since the folder
+// depends on the current plugin.
+
+enum { POSITION_WINDOW=0, POSITION_CONSOLE, POSITION_FILE_COUNT };
+static char *positionFileNames[POSITION_FILE_COUNT] = { "windowpos.txt", "consolepos.txt" };
+const double POSITION_WRITE_DELAY = 0.5;
+
+struct PositionWrite {
+	char path[512];
+	int x, y, w, h;
+	int pending;
+};
+
+static int positionDirty[POSITION_FILE_COUNT] = { 0, };
+static double positionChangedAt[POSITION_FILE_COUNT] = { 0, };
+static int positionGeom[POSITION_FILE_COUNT][4];
+static char positionPath[POSITION_FILE_COUNT][512];
+
+static void positionFileWrite( PositionWrite &pw ) {
+	FILE *file = fopen( pw.path, "wt" );
+	if( !file ) {
+		userLocalFolderRestore( pw.path );
+		file = fopen( pw.path, "wt" );
+	}
+	if( file ) {
+		fprintf( file, "%d\n", pw.x );
+		fprintf( file, "%d\n", pw.y );
+		fprintf( file, "%d\n", pw.w );
+		fprintf( file, "%d\n", pw.h );
+		fclose( file );
+	}
+}
+
+#ifdef ZMSG_MULTITHREAD
+static pthread_mutex_t positionWriteMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t positionWriteCond = PTHREAD_COND_INITIALIZER;
+static PositionWrite positionWriteQueue[POSITION_FILE_COUNT];
+	// one slot per file; a newer position replaces one not yet written
+static int positionWriterRunning = 0;
+static int positionWriterQuit = 0;
+static pthread_t positionWriterThread;
+
+static void *positionWriterMain( void * ) {
+	pthread_mutex_lock( &positionWriteMutex );
+	while( 1 ) {
+		int i, any = 0;
+		for( i=0; i<POSITION_FILE_COUNT; i++ ) {
+			any |= positionWriteQueue[i].pending;
+		}
+		if( !any ) {
+			if( positionWriterQuit ) {
+				break;
+			}
+			pthread_cond_wait( &positionWriteCond, &positionWriteMutex );
+			continue;
+		}
+
+		PositionWrite writes[POSITION_FILE_COUNT];
+		memcpy( writes, positionWriteQueue, sizeof(writes) );
+		for( i=0; i<POSITION_FILE_COUNT; i++ ) {
+			positionWriteQueue[i].pending = 0;
+		}
+		pthread_mutex_unlock( &positionWriteMutex );
+		for( i=0; i<POSITION_FILE_COUNT; i++ ) {
+			if( writes[i].pending ) {
+				positionFileWrite( writes[i] );
+			}
+		}
+		pthread_mutex_lock( &positionWriteMutex );
+	}
+	pthread_mutex_unlock( &positionWriteMutex );
+	return 0;
+}
+#endif
+
+void positionFileChanged( int which, int x, int y, int w, int h ) {
+	positionGeom[which][0] = x;
+	positionGeom[which][1] = y;
+	positionGeom[which][2] = w;
+	positionGeom[which][3] = h;
+	if( !positionDirty[which] ) {
+		strncpy( positionPath[which], getUserLocalFilespec( positionFileNames[which], 0 ), sizeof(positionPath[which])-1 );
+		positionPath[which][sizeof(positionPath[which])-1] = 0;
+	}
+	positionDirty[which] = 1;
+	positionChangedAt[which] = zTime;
+}
+
+void positionFilesMaintain( int flush ) {
+	// Called every frame; flush writes everything now regardless of the delay
+	for( int i=0; i<POSITION_FILE_COUNT; i++ ) {
+		if( !positionDirty[i] || ( !flush && zTime - positionChangedAt[i] < POSITION_WRITE_DELAY ) ) {
+			continue;
+		}
+		positionDirty[i] = 0;
+
+		PositionWrite pw;
+		strcpy( pw.path, positionPath[i] );
+		pw.x = positionGeom[i][0];
+		pw.y = positionGeom[i][1];
+		pw.w = positionGeom[i][2];
+		pw.h = positionGeom[i][3];
+		pw.pending = 1;
+
+		#ifdef ZMSG_MULTITHREAD
+			pthread_mutex_lock( &positionWriteMutex );
+			if( !positionWriterRunning ) {
+				positionWriterRunning = !pthread_create( &positionWriterThread, 0, positionWriterMain, 0 );
+			}
+			if( positionWriterRunning ) {
+				positionWriteQueue[i] = pw;
+				pthread_cond_signal( &positionWriteCond );
+			}
+			pthread_mutex_unlock( &positionWriteMutex );
+			if( !positionWriterRunning ) {
+				positionFileWrite( pw );
+			}
+		#else
+			positionFileWrite( pw );
+		#endif
+	}
+}
+
+void positionFilesShutdown() {
+	// WRITE anything still pending and wait for the writer to finish
+	positionFilesMaintain( 1 );
+	#ifdef ZMSG_MULTITHREAD
+		if( positionWriterRunning ) {
+			pthread_mutex_lock( &positionWriteMutex );
+			positionWriterQuit = 1;
+			pthread_cond_signal( &positionWriteCond );
+			pthread_mutex_unlock( &positionWriteMutex );
+			pthread_join( positionWriterThread, 0 );
+			positionWriterRunning = 0;
+		}
+	#endif
+}
+
 // Plugin
 //===============================================================================
 
@@ -459,24 +756,33 @@ ZMSG_HANDLER( PluginChange ) {
 		// Do nothing if the requested plugin is blank or already running
 		return;
 	}
-	strcpy( newPlugin, which );
+	ZlabPlugin *plugin = zlabPluginFind( which );
+	if( !plugin ) {
+		trace( "PluginChange: no plugin named '%s'\n", which );
+		return;
+	}
+	strcpy( newPlugin, plugin->name );
+		// registry names always fit, see ZLAB_PLUGIN_NAME_MAX
 }
 
 void pluginMaintain() {
 	if( newPlugin[0] ) {
 		// SEARCH for new plugin
-		ZHashTable *pluginHash = zPluginGetPropertyTable( newPlugin );
-		if( !pluginHash ) return;
+		ZlabPlugin *next = zlabPluginFind( newPlugin );
+		if( !next ) return;
+		ZlabPlugin *prev = zlabPluginFind( curPlugin );
 
 		// CLEAR out the var list
 		zMsgQueue( "type=ZUIVarEdit_Clear toZUI=pluginVars" );
 		zMsgDispatch( zTime );
 
+		// SAVE positions recorded under the old plugin to its folder
+		positionFilesMaintain( 1 );
+
 		// SHUTDOWN old plugin
-		typedef void (*ShutdownFnPtr)();
-		ShutdownFnPtr shutdown = (ShutdownFnPtr)zPluginGetP( curPlugin, "shutdown" );
-		if( shutdown ) {
-			(*shutdown)();
+		if( prev && prev->shutdown ) {
+			ZlabMemTagScope memTag( ZLAB_MEM_PLUGIN );
+			(*prev->shutdown)();
 			ZUI::zuiGarbageCollect();
 		}
 
@@ -504,13 +810,73 @@ void pluginMaintain() {
 
 		// STARTUP new plugin
 		zviewpointReset();
-		typedef void (*StartupFnPtr)();
-		StartupFnPtr startup = (StartupFnPtr)zPluginGetP( curPlugin, "startup" );
-		if( startup ) {
-			(*startup)();
+		if( next->startup ) {
+			ZlabMemTagScope memTag( ZLAB_MEM_PLUGIN );
+			(*next->startup)();
+		}
+
+	}
+}
+
+const int PLUGIN_BUTTONS_PER_FRAME = 32;
+int pluginButtonsNext = -1;
+	// index into the plugin registry of the next choice button to create, -1 when done
+int pluginButtonsShown = 0;
+
+ZMSG_HANDLER( BuildPluginChoiceButton ) {
+	// BUILD up the list of plugin buttons that are used in the control panel.
+	// The buttons themselves are created a batch per frame by pluginChoiceButtonsMaintain()
+	ZUI *panel = ZUI::zuiFindByName( "pluginButtonPanel" );
+	if( !panel ) return;
+
+	int pluginCount = zlabPluginCount();
+	if( pluginCount > 20 ) {
+		panel->putI( "table_cols", 3 );
+	}
+	else {
+		panel->putI( "table_cols", 2 );
+	}
+
+	pluginButtonsNext = 0;
+	pluginButtonsShown = 0;
+}
+
+void pluginChoiceButtonsMaintain() {
+	if( pluginButtonsNext < 0 ) {
+		return;
+	}
+	ZUI *panel = ZUI::zuiFindByName( "pluginButtonPanel" );
+	if( !panel ) {
+		pluginButtonsNext = -1;
+		return;
+	}
+
+	int pluginCount = zlabPluginCount();
+	int end = pluginButtonsNext + PLUGIN_BUTTONS_PER_FRAME;
+	if( end > pluginCount ) {
+		end = pluginCount;
+	}
+	for( int i=pluginButtonsNext; i<end; i++ ) {
+		ZlabPlugin *plugin = zlabPluginGet( i );
+		#ifndef DEV
+		if( !strcmp(plugin->name,"null") ) {
+			continue;
 		}
+		#endif
 
+		// KEY bindings run 5.1 .. 5.9, 6.0 .. 6.9, 7.0 ... in name order
+		int keyIndex = pluginButtonsShown + 1;
+		int keyMajor = 5 + keyIndex / 10;
+		int keyMinor = keyIndex % 10;
+		pluginButtonsShown++;
+
+		ZUI *button = ZUI::factory( 0, "ZUIButton" );
+		button->putS( "text", plugin->name );
+		button->putS( "keyBinding", zlabFrameStr("%d.%d",keyMajor,keyMinor) );
+		button->putS( "sendMsg", zlabFrameStr("type=PluginChange which=%s",plugin->name) );
+		button->attachTo( panel );
 	}
+	pluginButtonsNext = end < pluginCount ? end : -1;
 }
 
 // Dispatch
@@ -531,6 +897,72 @@ void defaultDispatch( ZMsg *msg ) {
 int line;
 int copyPixels = -1;
 
+// Input latency
+//===============================================================================
+// Each input event's arrival is noted for zlablatency.  Keys and chars come
+// through callbacks; the pointer and buttons are polled and compared, since
+// zmousemsg reads them that way too.  With lateLatchInput on, render() polls
+// once more just before drawing the tree and updates the mouse state, so drag
+// and hover drawing follows the pointer as of now rather than as of the start
+// of the frame.  Nothing is dispatched there: key, button and other messages
+// raised by that poll stay queued for the next mainLoop(), and a refresh
+// request waits until the tree has been drawn.
+
+int lateLatchInput = 0;
+int latchingInput = 0;
+	// set during render()'s late poll
+int refreshDeferred = 0;
+
+void latencyInput( int nextFrame ) {
+	// Input raised during the late poll isn't handled until the next frame
+	if( nextFrame ) {
+		zlabLatencyInputNextFrame( zTimeNow() );
+	}
+	else {
+		zlabLatencyInput( zTimeNow() );
+	}
+}
+
+void GLFWCALL latencyKeyHandler( int key, int action ) {
+	latencyInput( latchingInput );
+	zglfwKeyHandler( key, action );
+}
+
+void GLFWCALL latencyCharHandler( int ch, int action ) {
+	latencyInput( latchingInput );
+	zglfwCharHandler( ch, action );
+}
+
+void GLFWCALL latchRefreshHandler() {
+	if( latchingInput ) {
+		refreshDeferred = 1;
+		return;
+	}
+	ZUI::dirtyAll();
+}
+
+void latencyPollPointer( int latched ) {
+	// latched is set for the late poll, which draws motion this frame
+	static int lastX = -1, lastY = -1, lastButtons = -1;
+	int x, y;
+	glfwGetMousePos( &x, &y );
+	int buttons = 0;
+	for( int i=0; i<3; i++ ) {
+		buttons |= glfwGetMouseButton( GLFW_MOUSE_BUTTON_1 + i ) == GLFW_PRESS ? 1<<i : 0;
+	}
+	if( lastButtons != -1 ) {
+		if( buttons != lastButtons ) {
+			latencyInput( latched );
+		}
+		else if( x != lastX || y != lastY ) {
+			latencyInput( 0 );
+		}
+	}
+	lastX = x;
+	lastY = y;
+	lastButtons = buttons;
+}
+
 void render() {
 #if defined(STOPFLOW)
 	if( !useDirtyRects ) {
@@ -597,9 +1029,29 @@ void render() {
 	}
 
 	SFTIME_END   (PerfTime_ID_Zlab_render_copy);
+	if( lateLatchInput ) {
+		// LATCH the pointer as it is now, see "Input latency" above
+		latchingInput = 1;
+		glfwPollEvents();
+		latchingInput = 0;
+		if( !glfwGetWindowParam( GLFW_OPENED ) ) {
+			return;
+		}
+		latencyPollPointer( 1 );
+		zMouseMsgUpdate();
+	}
+
 	SFTIME_START (PerfTime_ID_Zlab_render_tree, PerfTime_ID_Zlab_render);
-	ZUI::zuiRenderTree();
+	{
+		ZlabMemTagScope memTag( ZLAB_MEM_ZUI );
+		ZUI::zuiRenderTree();
+	}
 	SFTIME_END (PerfTime_ID_Zlab_render_tree);
+
+	if( refreshDeferred ) {
+		refreshDeferred = 0;
+		ZUI::dirtyAll();
+	}
 }
 
 // Window 
@@ -630,14 +1082,7 @@ void writeWindowPos() {
 		return;
 	}
 
-	FILE *file = fopen( getUserLocalFilespec( "windowpos.txt", 0 ), "wt" );
-	if( file ) {
-		fprintf( file, "%d\n", x );
-		fprintf( file, "%d\n", y );
-		fprintf( file, "%d\n", w );
-		fprintf( file, "%d\n", h );
-		fclose( file );
-	}
+	positionFileChanged( POSITION_WINDOW, x, y, w, h );
 }
 
 void readWindowPos() {
@@ -665,14 +1110,7 @@ void readWindowPos() {
 void writeConsolePos() {
 	int x, y, w, h;
 	zconsoleGetPosition( x, y, w, h );
-	FILE *file = fopen( getUserLocalFilespec( "consolepos.txt", 0 ), "wt" );
-	if( file ) {
-		fprintf( file, "%d\n", x );
-		fprintf( file, "%d\n", y );
-		fprintf( file, "%d\n", w );
-		fprintf( file, "%d\n", h );
-		fclose( file );
-	}
+	positionFileChanged( POSITION_CONSOLE, x, y, w, h );
 }
 
 void readConsolePos() {
@@ -713,18 +1151,83 @@ void moveHandler( int x, int y ) {
 }
 
 
+// Overlay
+//===============================================================================
+
+int overlayStatLines() {
+	// Lines drawn by renderOverlayStats(); one per tag when memory is tracked
+	return 3 + ( zlabMemTrackLevel() >= 2 ? ZLAB_MEM_TAG_COUNT : 0 );
+}
+
+void renderOverlayStats( float x, float y ) {
+	// Lines drawn under the zprof GUI; overlayStatLines() must match
+	int allocs = zlabFrameHeapAllocs();
+	int arenaUsedK = zlabFrameArenaUsed() / 1024;
+	int arenaSizeK = zlabFrameArenaSize() / 1024;
+	char *line;
+	if( allocs >= 0 ) {
+		line = zlabFrameStr( "heap allocs/frame: %d  arena: %dK/%dK", allocs, arenaUsedK, arenaSizeK );
+	}
+	else {
+		line = zlabFrameStr( "heap allocs/frame: n/a  arena: %dK/%dK", arenaUsedK, arenaSizeK );
+	}
+	zglFontPrintInverted( line, x, y, "controls" );
+
+	int glIssued = zlabGLStateIssuedLastFrame();
+	if( glIssued >= 0 ) {
+		line = zlabFrameStr( "gl state calls/frame: %d issued  %d elided", glIssued, zlabGLStateElidedLastFrame() );
+	}
+	else {
+		line = zlabFrameStr( "gl state calls/frame: n/a" );
+	}
+	y += 16.f;
+	zglFontPrintInverted( line, x, y, "controls" );
+
+	double p50, p90, p99, pMax;
+	int latencySamples = zlabLatencyPercentiles( p50, p90, p99, pMax );
+	line = zlabFrameStr( "input->swap ms: p50 %.1f  p90 %.1f  p99 %.1f  (%d)", p50 * 1000.0, p90 * 1000.0, p99 * 1000.0, latencySamples );
+	y += 16.f;
+	zglFontPrintInverted( line, x, y, "controls" );
+
+	if( zlabMemTrackLevel() >= 2 ) {
+		for( int i=0; i<ZLAB_MEM_TAG_COUNT; i++ ) {
+			ZlabMemTagStats stats;
+			zlabMemTagGetStats( i, stats );
+			y += 16.f;
+			line = zlabFrameStr( "%-6s live %lldK  peak %lldK  %d/frame", zlabMemTagName( i ), stats.liveBytes / 1024, stats.peakBytes / 1024, stats.allocsLastFrame );
+			zglFontPrintInverted( line, x, y, "controls" );
+		}
+	}
+}
+
 // Main Loop
 //===============================================================================
 
+double assetUploadBudgetSecs = 0.004;
+	// time per frame for asset GL uploads, option assetUploadBudgetMs
+
+int pipelineFrames = 0;
+	// With option pipelineFrames the next frame's mainLoop() runs between glFlush
+	// and glfwSwapBuffers, so the CPU updates while the GPU is still drawing the
+	// frame just submitted instead of both waiting on each other.  Input that
+	// glfw picks up during the swap is then handled a frame later; lateLatchInput
+	// wins that back for pointer motion.
+
 void mainLoop() {
 	SFTIME_START (PerfTime_ID_Zlab_main_mouse, PerfTime_ID_Zlab_main);
+	latencyPollPointer( 0 );
 	zMouseMsgUpdate();
 	SFTIME_END (PerfTime_ID_Zlab_main_mouse);
 
 	zTimeTick();
 	
-	statusLineText[0] = 0;
-	strcat( statusLineText, ZTmpStr( "%3.1f", zTimeAvgFPS ) );
+	// REFORMAT the status line only when the fps changes at its display precision
+	static int lastFPSTenths = -1;
+	int fpsTenths = (int)floor( zTimeAvgFPS * 10.0 + 0.5 );
+	if( fpsTenths != lastFPSTenths ) {
+		sprintf( statusLineText, "%3.1f", (double)fpsTenths / 10.0 );
+		lastFPSTenths = fpsTenths;
+	}
 
 	#ifdef WIN32
 //	SwitchToThread();
@@ -737,19 +1240,45 @@ void mainLoop() {
 	pluginMaintain();
 		// The switching between plugins needs to be synchronous
 
+	pluginChoiceButtonsMaintain();
+
 	SFTIME_START (PerfTime_ID_Zlab_main_dispatch, PerfTime_ID_Zlab_main);
-	zMsgDispatch( zTime );
+	{
+		ZlabMemTagScope memTag( ZLAB_MEM_MSG );
+		zMsgDispatch( zTime );
+	}
 	SFTIME_END (PerfTime_ID_Zlab_main_dispatch);
 
 	SFTIME_START (PerfTime_ID_Zlab_main_update, PerfTime_ID_Zlab_main);
-	ZUI::zuiUpdate( zTime );
+	{
+		ZlabMemTagScope memTag( ZLAB_MEM_ZUI );
+		ZUI::zuiUpdate( zTime );
+	}
 	SFTIME_END (PerfTime_ID_Zlab_main_update);
+
+	zlabAssetsMaintain( assetUploadBudgetSecs );
+		// completes asset loads and spreads their GL uploads over frames
 }
 
 ZMSG_HANDLER( QuitApp ) {
 	glfwCloseWindow();
 }
 
+void applyOptionsToVars( ZHashTable &table ) {
+	// Any key naming a registered var sets that var
+	for( int i=0; i<table.size(); i++ ) {
+		char *k = table.getKey(i);
+		char *v = table.getValS(i);
+		if( k && v ) {
+			ZVarPtr *varPtr = zVarsLookup( k );
+			if( varPtr ) {
+				double val = strtod( v, NULL );
+				varPtr->setFromDouble( val );
+			}
+		}
+	}
+}
+
 void loadOptionsConfigFile() {
 	ZRegExp keyRegExp( "^key_([a-zA-Z0-9]+)" );
 
@@ -763,71 +1292,85 @@ void loadOptionsConfigFile() {
 		// code that potentially runs before main() should use this to know whether
 		// extern'd options hashtable has been loaded.
 
+	applyOptionsToVars( options );
 	for( int i=0; i<options.size(); i++ ) {
 		char *k = options.getKey(i);
 		char *v = options.getValS(i);
-		if( k && v ) {
-			ZVarPtr *varPtr = zVarsLookup( k );
-			if( varPtr ) {
-				double val = strtod( v, NULL );
-				varPtr->setFromDouble( val );
-			}
-		}
 		if( k && keyRegExp.test( k ) ) {
 			ZUI::zuiBindKey( keyRegExp.get(1), v );
 		}
 	}
 }
 
-int stringCompare(const void *a, const void *b) {
-	// This just calls strcmp because undergccI had a problem linking to __cdecl
-	// so I just put this stub in
-	return strcmp( (const char*)a, (const char*)b );
+// Sweep runs
+//===============================================================================
+// tools/zlabsweep.pl runs one zlab per point of a parameter sweep.  Each gets a
+// config file named by the ZLAB_SWEEP_POINT environment variable holding the
+// var values of its point and some of these options:
+//   runFrames        quit after this many frames
+//   sweepOut         file the sweepVars are written to at exit
+//   sweepVars        names of the vars to report, space or comma separated
+//   userLocalFolder  a folder of its own for trace.txt and the like
+//   runIconified     minimize the window
+// A plugin that can tell when it has finished queues "type=SweepDone" to quit
+// without waiting for runFrames.
+
+int sweepFramesLeft = 0;
+int sweepFramesRun = 0;
+int sweepDone = 0;
+
+ZMSG_HANDLER( SweepDone ) {
+	sweepDone = 1;
+	glfwCloseWindow();
 }
 
-ZMSG_HANDLER( BuildPluginChoiceButton ) {
-	// BUILD up the list of plugin buttons that are used in the control panel
-	ZUI *panel = ZUI::zuiFindByName( "pluginButtonPanel" );
-	if( !panel ) return;
+void sweepLoadPoint() {
+	char *point = getenv( "ZLAB_SWEEP_POINT" );
+	if( point && *point ) {
+		ZHashTable pointOptions;
+		zConfigLoadFile( point, pointOptions );
+		options.copyFrom( pointOptions );
+		applyOptionsToVars( pointOptions );
+	}
+	sweepFramesLeft = options.getI( "runFrames", 0 );
+}
 
-	char sortedPluginNames[128][32];
-	int sortedPluginCount = 0;
-	assert( sortedPluginCount < 128 );
-	int last = -1;
-	ZHashTable *plugin = 0;
-	while( zPluginEnum( last, plugin ) ) {
-		strcpy( sortedPluginNames[sortedPluginCount], plugin->getS("name") );
-		sortedPluginCount++;
+void sweepFrameMaintain() {
+	// Once per frame, after its swap
+	sweepFramesRun++;
+	if( sweepFramesLeft > 0 && --sweepFramesLeft == 0 ) {
+		glfwCloseWindow();
 	}
+}
 
-	if( sortedPluginCount > 20 ) {
-		panel->putI( "table_cols", 3 );
+void sweepWriteResults() {
+	char *path = options.getS( "sweepOut", 0 );
+	if( !path || !*path ) {
+		return;
 	}
-	else {
-		panel->putI( "table_cols", 2 );
+	FILE *f = fopen( path, "wt" );
+	if( !f ) {
+		trace( "Unable to write sweep results to %s\n", path );
+		return;
 	}
 
-	int keyMajor = 5;
-	int keyMinor = 1;
-
-	qsort( sortedPluginNames, sortedPluginCount, 32, stringCompare );
-	for( int i=0; i<sortedPluginCount; i++ ) {
-		#ifndef DEV
-		if( !strcmp(sortedPluginNames[i],"null") ) {
-			continue;
+	char names[1024];
+	strncpy( names, options.getS( "sweepVars", "" ), sizeof(names)-1 );
+	names[sizeof(names)-1] = 0;
+	for( char *name = strtok( names, " ,\t" ); name; name = strtok( 0, " ,\t" ) ) {
+		ZVarPtr *varPtr = zVarsLookup( name );
+		if( varPtr ) {
+			fprintf( f, "%s = %.17g\n", name, varPtr->getDouble() );
 		}
-		#endif
-		ZUI *button = ZUI::factory( 0, "ZUIButton" );
-		button->putS( "text", sortedPluginNames[i] );
-		button->putS( "keyBinding", ZTmpStr("%d.%d",keyMajor,keyMinor) );
-		keyMinor++;
-		if( keyMinor > 9 ) {
-			keyMinor = 0;
-			keyMajor++;
+		else {
+			trace( "sweepVars: no var named %s\n", name );
 		}
-		button->putS( "sendMsg", ZTmpStr("type=PluginChange which=%s",sortedPluginNames[i]) );
-		button->attachTo( panel );
 	}
+	fprintf( f, "frames = %d\n", sweepFramesRun );
+	fprintf( f, "sweepDone = %d\n", sweepDone );
+	fprintf( f, "complete = 1\n" );
+		// last, so that a run killed while writing is seen as failed
+	fclose( f );
 }
 
 ZMSG_HANDLER( ToggleConsole ) {
@@ -844,14 +1387,70 @@ ZMSG_HANDLER( ToggleConsole ) {
 
 int zprofDumpFlag = 0;
 int zprofToggleFlag = 0;
+
+void samplerStart() {
+	// The sampling profiler runs from f3 (ZProfResetAvg) until f4 (ZProfDump)
+	// or exit, or from startup with the samplerAutoStart option
+	int hz = options.getI( "samplerHz", 1000 );
+	if( zlabSamplerStart( hz, options.getI( "samplerMaxSamples", 60 * hz ) ) ) {
+		trace( "Sampling profiler started at %d Hz\n", hz );
+	}
+}
+
+void samplerStopAndDump() {
+	if( zlabSamplerIsRunning() ) {
+		zlabSamplerStop();
+		char *path = getUserLocalFilespec( "profile.folded", 0 );
+		int n = zlabSamplerDump( path );
+		trace( "Sampling profiler wrote %d samples to %s\n", n, path );
+	}
+}
+
 ZMSG_HANDLER( ZProfDump ) {
 	zprofDumpFlag = 1;
+	samplerStopAndDump();
 }
 ZMSG_HANDLER( ZProfToggle ) {
 	zprofToggleFlag = 1;
 }
 ZMSG_HANDLER( ZProfResetAvg ) {
 	zprofReset( 1 );
+	samplerStart();
+}
+
+ZMSG_HANDLER( CaptureToggle ) {
+	// START or stop capturing frames into a new numbered folder under the
+	// captureDir option (default the user-local folder).  format=raw (or the
+	// captureFormat option) writes raw video instead of a PNG sequence.
+	if( zlabCaptureIsActive() ) {
+		zlabCaptureStop();
+		return;
+	}
+
+	char *format = zmsgHas(format) ? zmsgS(format) : options.getS( "captureFormat", "png" );
+	char *base = options.getS( "captureDir", 0 );
+	if( !base || !*base ) {
+		base = getUserLocalAppFolder();
+	}
+
+	char dir[512];
+	for( int i=0; i<1000; i++ ) {
+		char name[32];
+		sprintf( name, "capture_%03d", i );
+		if( !zlabPathJoinR( base, name, dir, sizeof(dir) ) ) {
+			trace( "CaptureToggle: capture folder path too long\n" );
+			return;
+		}
+		if( !zWildcardFileExists( dir ) ) {
+			break;
+		}
+	}
+	#ifdef WIN32
+		mkdir( dir );
+	#else
+		mkdir( dir, 0777 );
+	#endif
+	zlabCaptureStart( dir, !strcmp( format, "raw" ) ? ZLAB_CAPTURE_RAW : ZLAB_CAPTURE_PNG );
 }
 
 #ifdef ZMSG_MULTITHREAD
@@ -895,9 +1494,15 @@ int main( int argc, char **argv )
 		// relies on findFolders having been called
 	options.copyFrom( cmdlineOptions );
 		// command-line options should override those specified in cfg files
+	sweepLoadPoint();
+		// a parameter sweep point overrides both
 	
 	options.dump(1);
 
+	// SETUP asset streaming
+	assetUploadBudgetSecs = options.getD( "assetUploadBudgetMs", 4.0 ) / 1000.0;
+	zlabAssetsSetCacheLimit( (size_t)options.getI( "assetCacheMB", 256 ) * 1024 * 1024 );
+
 	// STARTUP Plugin
 	startupPlugin = options.getS( "startupPlugin" );
 	if( startupPlugin && startupPlugin[0] == '_' ) {
@@ -1000,13 +1605,20 @@ int main( int argc, char **argv )
 	trace( "Reading window position...\n" );
 	readWindowPos();
 	readConsolePos();
+	if( options.getI( "runIconified" ) ) {
+		glfwIconifyWindow();
+	}
+	zlabGLStateEnable( options.getI( "glStateShadow", 1 ) );
+		// see zlabglstate.h; 0 forwards every state call to GL
+	lateLatchInput = options.getI( "lateLatchInput", 0 );
+	pipelineFrames = options.getI( "pipelineFrames", 0 );
 
 	// SETUP window callbacks
 	trace( "Setting up glfw callbacks...\n" );
-	glfwSetWindowRefreshCallback( ZUI::dirtyAll ); 
+	glfwSetWindowRefreshCallback( latchRefreshHandler ); 
 	glfwEnable( GLFW_KEY_REPEAT );
-	glfwSetCharCallback( zglfwCharHandler );
-	glfwSetKeyCallback( zglfwKeyHandler );
+	glfwSetCharCallback( latencyCharHandler );
+	glfwSetKeyCallback( latencyKeyHandler );
 	glfwSetMouseWheelCallback( zglfwMouseWheelHandler );
 	if( bFullScreen ) {
 		glfwEnable( GLFW_MOUSE_CURSOR );
@@ -1028,6 +1640,7 @@ int main( int argc, char **argv )
 	ZUI::zuiBindKey( "f2", "type=ZProfToggle" );
 	ZUI::zuiBindKey( "f3", "type=ZProfResetAvg" );
 	ZUI::zuiBindKey( "f4", "type=ZProfDump" );
+	ZUI::zuiBindKey( "f5", "type=CaptureToggle" );
 
 	// SETUP the default dispatcher
 	zMsgSetHandler( "default", defaultDispatch );
@@ -1049,8 +1662,14 @@ int main( int argc, char **argv )
 	trace( success ? (char*)"Yes.\n" : (char*)"No!\n" );
 	assert( zWildcardFileExists( zlabCorePath( "main.zui" ) ) );
 	trace( "Loading fonts, processing ZUI file '%s'...\n", zlabCorePath( "main.zui" ) );
-	zglFontLoad( "controls", zlabCorePath( "verdana.ttf" ), 10, 1, 255 );
-	ZUI::zuiExecuteFile( zlabCorePath( "main.zui" ) );
+	{
+		ZlabMemTagScope memTag( ZLAB_MEM_FONT );
+		zglFontLoad( "controls", zlabCorePath( "verdana.ttf" ), 10, 1, 255 );
+	}
+	{
+		ZlabMemTagScope memTag( ZLAB_MEM_ZUI );
+		ZUI::zuiExecuteFile( zlabCorePath( "main.zui" ) );
+	}
 
 	// BUILD the plugin buttons
 	zMsgQueue( "type=BuildPluginChoiceButton" );
@@ -1065,9 +1684,20 @@ int main( int argc, char **argv )
 		SetClassLongPtr( hWnd, GCLP_HICON, (long)hIcon );
 	#endif
 
+	if( options.getI( "samplerAutoStart" ) ) {
+		samplerStart();
+	}
+
 	int running = 1;
+	int updatedAhead = 0;
+		// set when the pipelined mainLoop() already ran for this frame
 	trace( "Entering main loop...\n" );
 	while( running ) {
+		if( !updatedAhead ) {
+			zlabFrameBegin();
+				// frame scratch memory from the previous iteration is now free
+			zlabGLStateFrame();
+		}
 
 		SFTIME_RESET ();
 		SFTIME_START (PerfTime_ID_Zlab, PerfTime_ID_None);
@@ -1096,11 +1726,14 @@ int main( int argc, char **argv )
 //		zprofReset( 0 );
 //		zprofBeg( root );
 
-		SFTIME_START (PerfTime_ID_Zlab_main, PerfTime_ID_Zlab);
-//		zprofBeg( mainLoop );
-			mainLoop();
-//		zprofEnd();
-		SFTIME_END (PerfTime_ID_Zlab_main);
+		if( !updatedAhead ) {
+			SFTIME_START (PerfTime_ID_Zlab_main, PerfTime_ID_Zlab);
+//			zprofBeg( mainLoop );
+				mainLoop();
+//			zprofEnd();
+			SFTIME_END (PerfTime_ID_Zlab_main);
+		}
+		updatedAhead = 0;
 
 		running = glfwGetWindowParam( GLFW_OPENED );
 
@@ -1109,6 +1742,9 @@ int main( int argc, char **argv )
 		int x, y, w, h;
 		glfwGetWindowGeom( &x, &y, &w, &h );
 		static int lastX=-1, lastY=-1, lastW=-1, lastH=-1;
+		static int layoutW=-1, layoutH=-1;
+			// size the ZUI tree was last laid out for.  A minimize (0x0) is not laid
+			// out, so restoring to the same size does not cost a full re-layout.
 		if( x!=lastX || y!=lastY || w!=lastW || h!=lastH ) {
 			// Moved this code from the callback reshape handler because under some
 			// mysterious conditions, the callback would go into an an infinite recursion.
@@ -1127,8 +1763,9 @@ int main( int argc, char **argv )
 			glClear( GL_COLOR_BUFFER_BIT );
 				// mkness - added clear to black.
 
-			if( w!=lastW || h!=lastH ) {
+			if( w != 0 && h != 0 && ( w!=layoutW || h!=layoutH ) ) {
 				ZUI::zuiReshape( (float)w, (float)h );
+				layoutW=w; layoutH=h;
 			}
 			if( w != 0 && h != 0 ) {
 				// Don't save if we are minimizing the app
@@ -1146,6 +1783,7 @@ int main( int argc, char **argv )
 				clastX=x; clastY=y; clastW=w; clastH=h;
 			}
 		}
+		positionFilesMaintain( 0 );
 		
 		if( running ) {
 			SFTIME_START (PerfTime_ID_Zlab_render, PerfTime_ID_Zlab);
@@ -1154,6 +1792,9 @@ int main( int argc, char **argv )
 //			zprofEnd();
 			SFTIME_END (PerfTime_ID_Zlab_render);
 
+			zlabCaptureFrame( layoutW, layoutH );
+				// before the overlay so that only the plugin's output is captured
+
 //			zprofEnd();	// root
 
 			extern int zprofGLGUIVisible;
@@ -1164,11 +1805,13 @@ int main( int argc, char **argv )
 				glBegin( GL_QUADS );
 					glVertex2f( 0.f, 0.f );
 					glVertex2f( 300.f, 0.f );
-					glVertex2f( 300.f, 300.f );
-					glVertex2f( 0.f, 300.f );
+					glVertex2f( 300.f, 300.f + 16.f * overlayStatLines() );
+					glVertex2f( 0.f, 300.f + 16.f * overlayStatLines() );
 				glEnd();
 				glColor3ub(0,0,0);
 				zprofGLGUIRender( 1 );
+				glColor3ub(0,0,0);
+				renderOverlayStats( 2.f, 302.f );
 				glPopMatrix();
 			}
 #ifdef ZPROF
@@ -1179,10 +1822,28 @@ int main( int argc, char **argv )
 			}
 #endif
 
+			zlabLatencySwapBegin();
+				// input seen from here on, including by the pipelined update,
+				// is not in the frame about to be shown
+
+			if( pipelineFrames ) {
+				// UPDATE the next frame while the GPU works through this one
+				glFlush();
+				zlabFrameBegin();
+				zlabGLStateFrame();
+				SFTIME_START (PerfTime_ID_Zlab_main, PerfTime_ID_Zlab);
+				mainLoop();
+				SFTIME_END (PerfTime_ID_Zlab_main);
+				updatedAhead = 1;
+			}
+
 			SFTIME_START (PerfTime_ID_Zlab_swap, PerfTime_ID_Zlab);
 //			zprofBeg( flush );
 			glFlush();
 			glfwSwapBuffers();
+			zlabLatencySwapEnd( zTimeNow() );
+			sweepFrameMaintain();
+				// the frame has been shown, so it counts towards runFrames
 //			zprofEnd();
 			SFTIME_END (PerfTime_ID_Zlab_swap);
 
@@ -1210,17 +1871,31 @@ int main( int argc, char **argv )
 
 	// SHUTDOWN the plugin
 	trace( "Shutdown the plugin...\n");
-	typedef void (*ShutdownFnPtr)();
-	ShutdownFnPtr shutdown = (ShutdownFnPtr)zPluginGetP( curPlugin, "shutdown" );
-	if( shutdown ) {
-		(*shutdown)();
+	ZlabPlugin *plugin = zlabPluginFind( curPlugin );
+	if( plugin && plugin->shutdown ) {
+		ZlabMemTagScope memTag( ZLAB_MEM_PLUGIN );
+		(*plugin->shutdown)();
+	}
+
+	samplerStopAndDump();
+	double p50, p90, p99, pMax;
+	int latencySamples = zlabLatencyPercentiles( p50, p90, p99, pMax );
+	if( latencySamples ) {
+		trace( "input->swap ms over %d frames: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", latencySamples, p50 * 1000.0, p90 * 1000.0, p99 * 1000.0, pMax * 1000.0 );
 	}
+	zlabCaptureStop();
+	positionFilesShutdown();
+	zlabAssetsShutdown();
 
 	glfwTerminate();
 
 
 	zVarsSave( getUserLocalFilespec( "varslastquit.txt", 0 ), 0 );
 	zVarsSave( getUserLocalFilespec( "varslastquit.c.txt", 0 ), 1 );
+	sweepWriteResults();
+
+	zlabMemTrackReport( getUserLocalFilespec( "memreport.txt", 0 ) );
+		// only written in ZLAB_MEMTRACK builds
 
 	#ifndef _DEBUG
 	}
@@ -42,47 +42,76 @@ class PrintHook:
 
 	#override write of stdout		
 	def write(self,text):
-		proceed = 1
-		lineNo = 0
-		addText = ''
 		if self.func != None:
 			proceed,lineNo,newText = self.func(text)
+		else:
+			proceed,lineNo,newText = 1,0,text
 		if proceed:
-			if text.split() == []:
-				self.origOut.write(text)
-			else:
-				#if goint to stdout then only add line no file etc
-				#for stderr it is already there
-				if self.out:
-					if lineNo:
-						try:
-							raise "Dummy"
-						except:
-							newText =  'line('+str(sys.exc_info()[2].tb_frame.f_back.f_lineno)+'):'+newText
-							codeObject = sys.exc_info()[2].tb_frame.f_back.f_code
-							fileName = codeObject.co_filename
-							funcName = codeObject.co_name
-					self.origOut.write('file '+fileName+','+'func '+funcName+':')					
-				self.origOut.write(newText)
-				
+			#if going to stdout then only add line no file etc
+			#for stderr it is already there
+			if lineNo and self.out and text.strip():
+				frame = sys._getframe(1)
+				self.origOut.write('file %s,func %s,line(%d):' % (frame.f_code.co_filename,frame.f_code.co_name,frame.f_lineno))
+			self.origOut.write(newText)
+
+	#send on any unfinished line held by the zlab hooks
+	def flush(self):
+		ZLabPrintFlush(self.out)
+		self.origOut.flush()
 
 	#pass all other methods to __stdout__ so that we don't have to override them
 	def __getattr__(self, name):
-		return self.origOut.__getattr__(name)
-	
+		return getattr(self.origOut, name)
+
+#A print statement arrives as several writes (each item, the spaces between
+#them and the newline) so the hooks collect them and hand zlabHookedPrint,
+#and so trace, whole lines only.  Set zlabPrintAttribution to 1 to prefix
+#each line of stdout with its file, function and line number; that costs a
+#frame lookup per write, so it is for debugging only.
+zlabPrintAttribution = 0
+zlabPrintAtLineStart = 1
+zlabPrintPending = ['','']
+	#text after the last newline, for stderr and stdout
+zlabPrintPendingMax = 4096
+
+def ZLabPrintBuffered(out,text):
+	pending = zlabPrintPending[out] + text
+	eol = pending.rfind('\n')
+	if eol >= 0:
+		zlabHookedPrint(pending[:eol+1])
+		pending = pending[eol+1:]
+	if len(pending) > zlabPrintPendingMax:
+		zlabHookedPrint(pending)
+		pending = ''
+	zlabPrintPending[out] = pending
+
+def ZLabPrintFlush(out):
+	if zlabPrintPending[out]:
+		zlabHookedPrint(zlabPrintPending[out])
+		zlabPrintPending[out] = ''
+
 def ZLabHookOut(text):
-	zlabHookedPrint(text)
-	return 0,1,text
+	global zlabPrintAtLineStart
+	if zlabPrintAttribution:
+		if zlabPrintAtLineStart and text.strip():
+			frame = sys._getframe(2)
+			text = 'file %s,func %s,line(%d):%s' % (frame.f_code.co_filename,frame.f_code.co_name,frame.f_lineno,text)
+		zlabPrintAtLineStart = text.endswith('\n')
+	ZLabPrintBuffered(1,text)
+	return 0,0,text
 
 def ZLabHookErr(text):
-	zlabHookedPrint(text)
-	return 0,1,text
+	ZLabPrintBuffered(0,text)
+	return 0,0,text
 
 phOut = PrintHook(1)
 phOut.Start(ZLabHookOut)
 phErr = PrintHook(0)
 phErr.Start(ZLabHookErr)
 print 'python stdout and stderr are now hooked.'
+import atexit
+atexit.register(ZLabPrintFlush,0)
+atexit.register(ZLabPrintFlush,1)
 #phOut.Stop()
 #print 'STDOUT Hook end'
 #compile(',','<string>','exec')
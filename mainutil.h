@@ -4,12 +4,29 @@
 void trace( char *msg, ... );
 void traceNoFormat( char *message );
 
+// The functions below return pointers into static buffers and so are only
+// safe to call from the main thread.
 char * zlabCorePath(  char *file );
 char * pluginPathVariable( );
 char * pluginPath( char *file );
 
+char * getUserLocalAppFolder();
 char * getUserLocalFilespec( char *basename, int bMustExist );
 
+// Versions without static buffers.  Each writes into the caller's buffer and
+// returns it, or returns 0 if the result does not fit (or, for
+// getUserLocalFilespecR with bMustExist, if the file does not exist).
+// Nothing is allocated.  Paths are joined with '/'.  They still read
+// curPlugin and options unlocked, so from another thread they are only safe
+// while neither is changing; snapshot the path on the main thread otherwise.
+char * zlabPathJoinR( char *dir, char *file, char *buf, int bufLen );
+char * zlabCorePathR( char *file, char *buf, int bufLen );
+char * pluginPathVariableR( char *buf, int bufLen );
+char * pluginPathR( char *file, char *buf, int bufLen );
+
+char * getUserLocalAppFolderR( char *buf, int bufLen );
+char * getUserLocalFilespecR( char *basename, int bMustExist, char *buf, int bufLen );
+
 class ZHashTable;
 extern ZHashTable options;
 
@@ -17,4 +34,3 @@ extern int copyPixels;
 
 
 #endif
-
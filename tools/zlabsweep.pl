@@ -0,0 +1,287 @@
+#!/usr/bin/perl
+use File::Spec;
+use File::Path 'mkpath';
+use POSIX ':sys_wait_h';
+
+#############################################################
+#
+# Parameter sweep runner for zlab plugins
+#
+# Runs one zlab per point of a parameter space, several at once, and collects
+# chosen plugin vars from each run into a CSV table.  See "Sweep runs" in
+# main.cpp for the zlab side.
+#
+# USAGE:
+#  perl tools/zlabsweep.pl myspec.sweep
+#
+# The spec file is "key = value" lines; # starts a comment:
+#
+#   exe = ../build/zlab          # the zlab to run
+#   plugin = bfly                # startupPlugin
+#   frames = 600                 # frames per run (0 = until the plugin queues SweepDone)
+#   outputs = Bfly_count Bfly_fps  # vars to collect at the end of each run
+#   jobs = 8                     # parallel runs, default the number of cores
+#   retries = 2                  # extra attempts for a failed point
+#   timeout = 300                # seconds before a run is killed and counts as failed
+#   iconify = 1                  # minimize the windows
+#   grid Bfly_count = 10 .. 100 step 10
+#   grid Bfly_speed = 0.5, 1, 2
+#   random Bfly_brightness = 0 .. 40
+#   samples = 20                 # random draws per grid point
+#   seed = 1
+#   option someOption = value    # any other zlab option, passed to every run
+#
+# Points are every combination of the grid values, each paired with "samples"
+# draws of the random vars.  Results go to <spec>.out/results.csv with one row
+# per point as it finishes, so an interrupted sweep keeps what it has done.
+# Running the same spec again skips the points already marked ok; the last row
+# for a point is the one that counts.
+#
+#############################################################
+
+my $specFile = $ARGV[0] or die "usage: perl zlabsweep.pl <specfile>\n";
+
+# DEFAULTS
+my %spec = ( frames => 600, jobs => numProcessors(), retries => 2, timeout => 300, iconify => 0, samples => 1, seed => 1 );
+my @gridNames;
+my %gridValues;
+my @randomNames;
+my %randomRange;
+my %passOptions;
+
+# PARSE the spec
+open( SPEC, $specFile ) || die "Unable to open $specFile\n";
+while( <SPEC> ) {
+	s/#.*//;
+	s/^\s+//;
+	s/\s+$//;
+	next if( $_ eq '' );
+	if( /^grid\s+(\w+)\s*=\s*(.*)$/ ) {
+		push @gridNames, $1;
+		$gridValues{$1} = [ parseValues( $2 ) ];
+	}
+	elsif( /^random\s+(\w+)\s*=\s*(\S+)\s*\.\.\s*(\S+)$/ ) {
+		push @randomNames, $1;
+		$randomRange{$1} = [ $2, $3 ];
+	}
+	elsif( /^option\s+(\w+)\s*=\s*(.*)$/ ) {
+		$passOptions{$1} = $2;
+	}
+	elsif( /^(\w+)\s*=\s*(.*)$/ ) {
+		$spec{$1} = $2;
+	}
+	else {
+		die "$specFile: can't parse '$_'\n";
+	}
+}
+close( SPEC );
+
+die "$specFile: no exe given\n" if( !$spec{exe} );
+my $exe = File::Spec->rel2abs( $spec{exe} );
+die "$specFile: $exe not found\n" if( ! -f $exe );
+my @outputs = split( /[\s,]+/, $spec{outputs} );
+
+# BUILD the points.  Random draws are seeded so that the points, and so the
+# point numbers used to resume, are the same every time the spec is run.
+my @points = ( {} );
+foreach my $name( @gridNames ) {
+	my @next;
+	foreach my $p( @points ) {
+		foreach my $v( @{ $gridValues{$name} } ) {
+			push @next, { %$p, $name => $v };
+		}
+	}
+	@points = @next;
+}
+if( @randomNames ) {
+	srand( $spec{seed} );
+	my @next;
+	foreach my $p( @points ) {
+		for( my $i=0; $i<$spec{samples}; $i++ ) {
+			my %q = %$p;
+			foreach my $name( @randomNames ) {
+				my( $lo, $hi ) = @{ $randomRange{$name} };
+				$q{$name} = $lo + rand() * ( $hi - $lo );
+			}
+			push @next, \%q;
+		}
+	}
+	@points = @next;
+}
+my @varNames = ( @gridNames, @randomNames );
+
+# SETUP the output folder and resume from earlier results
+my $outDir = File::Spec->rel2abs( "$specFile.out" );
+mkpath( "$outDir/points" );
+my $resultsFile = "$outDir/results.csv";
+my %finished;
+if( -f $resultsFile ) {
+	open( RESULTS, $resultsFile );
+	<RESULTS>;
+	while( <RESULTS> ) {
+		my @cols = split( /,/ );
+		$finished{ $cols[0] } = 1 if( $cols[ 1 + @varNames + @outputs ] eq 'ok' );
+	}
+	close( RESULTS );
+}
+else {
+	open( RESULTS, ">$resultsFile" ) || die "Unable to write $resultsFile\n";
+	print RESULTS join( ',', 'point', @varNames, @outputs, 'status', 'attempts', 'seconds' ) . "\n";
+	close( RESULTS );
+}
+
+my @todo = grep { !$finished{$_} } ( 0 .. $#points );
+print scalar( @points ) . " points, " . scalar( keys %finished ) . " already done, running " . scalar( @todo ) . " with $spec{jobs} jobs\n";
+
+# RUN the points, keeping $spec{jobs} zlabs going
+my %running;
+	# pid => { point, attempt, start }
+my %attempts;
+my @queue = @todo;
+my $done = 0;
+while( @queue || %running ) {
+	while( @queue && scalar( keys %running ) < $spec{jobs} ) {
+		my $i = shift @queue;
+		my $slot = freeSlot( \%running );
+		my $pid = startPoint( $i, $slot );
+		$attempts{$i}++;
+		$running{$pid} = { point => $i, slot => $slot, start => time() };
+	}
+
+	sleep( 1 );
+
+	foreach my $pid( keys %running ) {
+		my $run = $running{$pid};
+		my $i = $run->{point};
+		my $elapsed = time() - $run->{start};
+		my $status;
+		if( waitpid( $pid, WNOHANG ) == $pid ) {
+			$status = $? == 0 ? 'exit' : "exit status $?";
+		}
+		elsif( $elapsed > $spec{timeout} ) {
+			kill( 'KILL', $pid );
+			waitpid( $pid, 0 );
+			$status = 'timeout';
+		}
+		else {
+			next;
+		}
+		delete $running{$pid};
+
+		my $results = readResults( $i );
+		if( $results ) {
+			recordPoint( $i, $results, 'ok', $elapsed );
+			$done++;
+			print "point $i ok ($done of " . scalar( @todo ) . ")\n";
+		}
+		elsif( $attempts{$i} <= $spec{retries} ) {
+			print "point $i failed ($status), retrying\n";
+			push @queue, $i;
+		}
+		else {
+			recordPoint( $i, {}, 'failed', $elapsed );
+			print "point $i failed ($status), giving up\n";
+		}
+	}
+}
+print "Results in $resultsFile\n";
+
+
+####################################################################################################
+#
+# UTILITY
+#
+####################################################################################################
+
+sub parseValues {
+	# "a .. b step s" or "v1, v2, ..."
+	my( $text ) = @_;
+	if( $text =~ /^(\S+)\s*\.\.\s*(\S+)\s+step\s+(\S+)$/ ) {
+		my( $lo, $hi, $step ) = ( $1, $2, $3 );
+		die "$specFile: step must be positive in '$text'\n" if( $step <= 0 );
+		my @v;
+		for( my $n=0; $lo + $n * $step <= $hi + $step * 1e-9; $n++ ) {
+			push @v, $lo + $n * $step;
+				# multiply rather than accumulate so the values don't drift
+		}
+		return @v;
+	}
+	return split( /\s*,\s*/, $text );
+}
+
+sub freeSlot {
+	# Lowest worker slot not in use; each slot has its own user-local folder
+	my( $running ) = @_;
+	my %used = map { $_->{slot} => 1 } values %$running;
+	my $slot = 0;
+	$slot++ while( $used{$slot} );
+	return $slot;
+}
+
+sub startPoint {
+	my( $i, $slot ) = @_;
+	my $p = $points[$i];
+	my $cfg = "$outDir/points/point_$i.cfg";
+	my $out = "$outDir/points/point_$i.out";
+	my $local = "$outDir/worker_$slot";
+	mkpath( $local );
+	unlink( $out );
+
+	open( CFG, ">$cfg" ) || die "Unable to write $cfg\n";
+	print CFG "startupPlugin = $spec{plugin}\n" if( $spec{plugin} );
+	print CFG "runFrames = $spec{frames}\n";
+	print CFG "runIconified = $spec{iconify}\n";
+	print CFG "sweepOut = \"$out\"\n";
+	print CFG "sweepVars = \"" . join( ' ', @outputs ) . "\"\n";
+	print CFG "userLocalFolder = \"$local\"\n";
+	foreach( sort keys %passOptions ) {
+		print CFG "$_ = $passOptions{$_}\n";
+	}
+	foreach( @varNames ) {
+		print CFG "$_ = $p->{$_}\n";
+	}
+	close( CFG );
+
+	my $pid = fork();
+	die "fork failed: $!\n" if( !defined $pid );
+	if( $pid == 0 ) {
+		$ENV{ZLAB_SWEEP_POINT} = $cfg;
+		exec( $exe ) || exit( 127 );
+	}
+	return $pid;
+}
+
+sub readResults {
+	# The vars a run reported, or undef if it didn't finish writing them
+	my( $i ) = @_;
+	my %r;
+	open( OUT, "$outDir/points/point_$i.out" ) || return undef;
+	while( <OUT> ) {
+		$r{$1} = $2 if( /^(\w+)\s*=\s*(.*?)\s*$/ );
+	}
+	close( OUT );
+	return $r{complete} ? \%r : undef;
+}
+
+sub recordPoint {
+	my( $i, $results, $status, $seconds ) = @_;
+	my $p = $points[$i];
+	open( RESULTS, ">>$resultsFile" ) || die "Unable to append to $resultsFile\n";
+	print RESULTS join( ',', $i, ( map { $p->{$_} } @varNames ), ( map { $results->{$_} } @outputs ), $status, $attempts{$i}, $seconds ) . "\n";
+	close( RESULTS );
+}
+
+sub numProcessors {
+	my $n;
+	if( $^O eq 'MSWin32' ) {
+		$n = $ENV{NUMBER_OF_PROCESSORS};
+	}
+	elsif( $^O eq 'darwin' ) {
+		$n = `sysctl -n hw.ncpu 2> /dev/null`;
+	}
+	else {
+		$n = `getconf _NPROCESSORS_ONLN 2> /dev/null`;
+	}
+	chomp $n;
+	return $n > 0 ? int( $n ) : 1;
+}
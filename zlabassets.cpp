@@ -0,0 +1,562 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Asynchronous file loading, decoding and time-sliced GL upload for plugins, with an LRU cache
+//		}
+//		*REQUIRED_FILES zlabassets.cpp zlabassets.h
+// }
+
+// OPERATING SYSTEM specific includes:
+#ifdef WIN32
+#include "windows.h"
+#else
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/stat.h"
+#include "sys/mman.h"
+#endif
+#ifdef ZMSG_MULTITHREAD
+// @ZBSIF extraDefines( 'ZMSG_MULTITHREAD' )
+	#include "pthread.h"
+// @ZBSENDIF
+#endif
+// STDLIB includes:
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "assert.h"
+// MODULE includes:
+#include "zlabassets.h"
+#include "mainutil.h"
+// ZBSLIB includes:
+#include "zmsg.h"
+#include "ztime.h"
+
+struct ZlabAssetWaiter {
+	char *msg;
+	ZlabAssetWaiter *next;
+};
+
+// Asset table, main thread
+//===============================================================================
+
+static ZlabAsset **assets = 0;
+static int assetsAlloc = 0;
+	// indexed by id; slot 0 unused, evicted slots are 0
+static unsigned int assetUseClock = 0;
+static size_t assetCacheLimit = 256 * 1024 * 1024;
+
+static ZlabAsset *uploadHead = 0;
+	// assets that have been read (and decoded) and are waiting for, or in the
+	// middle of, their upload callback
+
+// Work queues, shared with the threads
+//===============================================================================
+
+static ZlabAsset *ioHead = 0, *ioTail = 0;
+static ZlabAsset *decodeHead = 0, *decodeTail = 0;
+static ZlabAsset *doneHead = 0, *doneTail = 0;
+
+static void queuePush( ZlabAsset *&head, ZlabAsset *&tail, ZlabAsset *a ) {
+	a->next = 0;
+	if( tail ) {
+		tail->next = a;
+	}
+	else {
+		head = a;
+	}
+	tail = a;
+}
+
+static ZlabAsset *queuePop( ZlabAsset *&head, ZlabAsset *&tail ) {
+	ZlabAsset *a = head;
+	if( a ) {
+		head = a->next;
+		if( !head ) {
+			tail = 0;
+		}
+		a->next = 0;
+	}
+	return a;
+}
+
+#ifdef ZMSG_MULTITHREAD
+static pthread_mutex_t assetMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ioCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t decodeCond = PTHREAD_COND_INITIALIZER;
+static int threadsQuit = 0;
+static int threadsRunning = 0;
+static const int MAX_DECODE_THREADS = 8;
+static pthread_t ioThread;
+static pthread_t decodeThreads[MAX_DECODE_THREADS];
+static int decodeThreadCount = 0;
+#define ASSET_LOCK() pthread_mutex_lock( &assetMutex )
+#define ASSET_UNLOCK() pthread_mutex_unlock( &assetMutex )
+#else
+#define ASSET_LOCK()
+#define ASSET_UNLOCK()
+#endif
+
+// Loading, any thread
+//===============================================================================
+
+static int assetRead( ZlabAsset *a ) {
+	a->data = 0;
+	a->size = 0;
+	a->mapped = 0;
+
+	#ifndef WIN32
+		int fd = open( a->path, O_RDONLY );
+		if( fd < 0 ) {
+			return 0;
+		}
+		struct stat st;
+		if( fstat( fd, &st ) ) {
+			close( fd );
+			return 0;
+		}
+		if( (unsigned long long)st.st_size > (size_t)-1 ) {
+			// too big to address in this process
+			close( fd );
+			return 0;
+		}
+		a->size = (size_t)st.st_size;
+		if( a->size == 0 ) {
+			close( fd );
+			return 1;
+		}
+		void *p = mmap( 0, a->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( p != MAP_FAILED ) {
+			madvise( p, a->size, MADV_WILLNEED );
+				// start the read-ahead now; decode will fault the rest in
+			close( fd );
+			a->data = (char *)p;
+			a->mapped = 1;
+			return 1;
+		}
+
+		// FALL back to read() when the file can't be mapped
+		a->data = (char *)malloc( a->size );
+		size_t got = 0;
+		while( a->data && got < a->size ) {
+			ssize_t n = read( fd, a->data + got, a->size - got );
+			if( n <= 0 ) {
+				break;
+			}
+			got += (size_t)n;
+		}
+		close( fd );
+		if( got != a->size ) {
+			free( a->data );
+			a->data = 0;
+			a->size = 0;
+			return 0;
+		}
+		return 1;
+	#else
+		FILE *f = fopen( a->path, "rb" );
+		if( !f ) {
+			return 0;
+		}
+		_fseeki64( f, 0, SEEK_END );
+		__int64 fileSize = _ftelli64( f );
+		_fseeki64( f, 0, SEEK_SET );
+		if( fileSize < 0 || (unsigned __int64)fileSize > (size_t)-1 ) {
+			fclose( f );
+			return 0;
+		}
+		a->size = (size_t)fileSize;
+		if( a->size > 0 ) {
+			a->data = (char *)malloc( a->size );
+			if( !a->data || fread( a->data, 1, a->size, f ) != a->size ) {
+				free( a->data );
+				a->data = 0;
+				a->size = 0;
+				fclose( f );
+				return 0;
+			}
+		}
+		fclose( f );
+		return 1;
+	#endif
+}
+
+static void assetFreeData( ZlabAsset *a ) {
+	if( a->data ) {
+		#ifndef WIN32
+		if( a->mapped ) {
+			munmap( a->data, a->size );
+		}
+		else
+		#endif
+		{
+			free( a->data );
+		}
+	}
+	a->data = 0;
+	a->size = 0;
+	a->mapped = 0;
+}
+
+static int assetDecode( ZlabAsset *a ) {
+	if( a->callbacks.decode ) {
+		return (*a->callbacks.decode)( a );
+	}
+	return 1;
+}
+
+#ifdef ZMSG_MULTITHREAD
+static void *ioThreadMain( void * ) {
+	ASSET_LOCK();
+	while( 1 ) {
+		ZlabAsset *a = queuePop( ioHead, ioTail );
+		if( !a ) {
+			if( threadsQuit ) {
+				break;
+			}
+			pthread_cond_wait( &ioCond, &assetMutex );
+			continue;
+		}
+		a->state = ZLAB_ASSET_LOADING;
+		ASSET_UNLOCK();
+
+		int ok = assetRead( a );
+
+		ASSET_LOCK();
+		if( ok && a->callbacks.decode ) {
+			a->state = ZLAB_ASSET_DECODING;
+			queuePush( decodeHead, decodeTail, a );
+			pthread_cond_signal( &decodeCond );
+		}
+		else {
+			a->state = ok ? ZLAB_ASSET_UPLOADING : ZLAB_ASSET_FAILED;
+			queuePush( doneHead, doneTail, a );
+		}
+	}
+	ASSET_UNLOCK();
+	return 0;
+}
+
+static void *decodeThreadMain( void * ) {
+	ASSET_LOCK();
+	while( 1 ) {
+		ZlabAsset *a = queuePop( decodeHead, decodeTail );
+		if( !a ) {
+			if( threadsQuit ) {
+				break;
+			}
+			pthread_cond_wait( &decodeCond, &assetMutex );
+			continue;
+		}
+		ASSET_UNLOCK();
+
+		int ok = assetDecode( a );
+
+		ASSET_LOCK();
+		a->state = ok ? ZLAB_ASSET_UPLOADING : ZLAB_ASSET_FAILED;
+		queuePush( doneHead, doneTail, a );
+	}
+	ASSET_UNLOCK();
+	return 0;
+}
+
+static int processorCount() {
+	#ifdef WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo( &info );
+		return (int)info.dwNumberOfProcessors;
+	#else
+		return (int)sysconf( _SC_NPROCESSORS_ONLN );
+	#endif
+}
+
+static void threadsStart() {
+	static int threadsFailed = 0;
+		// once they can't be started, don't try again for every request
+	if( threadsRunning || threadsFailed ) {
+		return;
+	}
+	threadsQuit = 0;
+	if( pthread_create( &ioThread, 0, ioThreadMain, 0 ) ) {
+		trace( "zlabassets: unable to start the I/O thread; loading on the main thread\n" );
+		threadsFailed = 1;
+		return;
+	}
+
+	// DECODE on all but one core, leaving that one for the main thread
+	int want = processorCount() - 1;
+	want = want < 1 ? 1 : ( want > MAX_DECODE_THREADS ? MAX_DECODE_THREADS : want );
+	decodeThreadCount = 0;
+	for( int i=0; i<want; i++ ) {
+		if( !pthread_create( &decodeThreads[decodeThreadCount], 0, decodeThreadMain, 0 ) ) {
+			decodeThreadCount++;
+		}
+	}
+	if( !decodeThreadCount ) {
+		// STOP the I/O thread too, or what it reads would wait forever for a decoder
+		trace( "zlabassets: unable to start a decode thread; loading on the main thread\n" );
+		ASSET_LOCK();
+		threadsQuit = 1;
+		pthread_cond_broadcast( &ioCond );
+		ASSET_UNLOCK();
+		pthread_join( ioThread, 0 );
+		threadsFailed = 1;
+		return;
+	}
+	threadsRunning = 1;
+}
+#endif
+
+// Main thread
+//===============================================================================
+
+static size_t assetBytes( ZlabAsset *a ) {
+	return a->size + a->decodedSize;
+}
+
+static void assetEvict( ZlabAsset *a ) {
+	if( a->callbacks.release ) {
+		(*a->callbacks.release)( a );
+	}
+	else {
+		free( a->decoded );
+	}
+	a->decoded = 0;
+	a->decodedSize = 0;
+	assetFreeData( a );
+
+	while( a->waiters ) {
+		ZlabAssetWaiter *next = a->waiters->next;
+		free( a->waiters->msg );
+		free( a->waiters );
+		a->waiters = next;
+	}
+
+	assets[a->id] = 0;
+	free( a );
+}
+
+static void assetAddWaiter( ZlabAsset *a, char *doneMsg ) {
+	if( doneMsg && *doneMsg ) {
+		ZlabAssetWaiter *w = (ZlabAssetWaiter *)malloc( sizeof(ZlabAssetWaiter) );
+		w->msg = strdup( doneMsg );
+		w->next = a->waiters;
+		a->waiters = w;
+	}
+}
+
+static void assetNotify( ZlabAsset *a ) {
+	while( a->waiters ) {
+		ZlabAssetWaiter *w = a->waiters;
+		a->waiters = w->next;
+		if( a->state == ZLAB_ASSET_FAILED ) {
+			zMsgQueue( "%s assetId=%d failed=1", w->msg, a->id );
+		}
+		else {
+			zMsgQueue( "%s assetId=%d", w->msg, a->id );
+		}
+		free( w->msg );
+		free( w );
+	}
+}
+
+int zlabAssetRequest( char *path, ZlabAssetCallbacks *callbacks, char *doneMsg ) {
+	assert( path );
+	if( strlen( path ) >= sizeof(((ZlabAsset *)0)->path) ) {
+		trace( "zlabAssetRequest: path too long: %s\n", path );
+		return 0;
+	}
+
+	// REUSE a cached or in-flight asset for the same file
+	for( int i=1; i<assetsAlloc; i++ ) {
+		ZlabAsset *a = assets[i];
+		if( a && !strcmp( a->path, path ) && a->state != ZLAB_ASSET_FAILED ) {
+			a->refCount++;
+			a->lastUsed = ++assetUseClock;
+			assetAddWaiter( a, doneMsg );
+			if( a->state == ZLAB_ASSET_READY ) {
+				assetNotify( a );
+			}
+			return a->id;
+		}
+	}
+
+	// FIND a free id
+	int id = 1;
+	while( id < assetsAlloc && assets[id] ) {
+		id++;
+	}
+	if( id >= assetsAlloc ) {
+		int newAlloc = assetsAlloc ? assetsAlloc * 2 : 64;
+		assets = (ZlabAsset **)realloc( assets, sizeof(ZlabAsset *) * newAlloc );
+		memset( assets + assetsAlloc, 0, sizeof(ZlabAsset *) * ( newAlloc - assetsAlloc ) );
+		assetsAlloc = newAlloc;
+	}
+
+	ZlabAsset *a = (ZlabAsset *)malloc( sizeof(ZlabAsset) );
+	memset( a, 0, sizeof(ZlabAsset) );
+	a->id = id;
+	strcpy( a->path, path );
+	if( callbacks ) {
+		a->callbacks = *callbacks;
+	}
+	a->state = ZLAB_ASSET_QUEUED;
+	a->inFlight = 1;
+	a->refCount = 1;
+	a->lastUsed = ++assetUseClock;
+	assetAddWaiter( a, doneMsg );
+	assets[id] = a;
+
+	#ifdef ZMSG_MULTITHREAD
+		threadsStart();
+	#endif
+	ASSET_LOCK();
+	queuePush( ioHead, ioTail, a );
+	#ifdef ZMSG_MULTITHREAD
+		pthread_cond_signal( &ioCond );
+	#endif
+	ASSET_UNLOCK();
+
+	return id;
+}
+
+ZlabAsset *zlabAssetGet( int id ) {
+	if( id > 0 && id < assetsAlloc && assets[id] ) {
+		assets[id]->lastUsed = ++assetUseClock;
+		return assets[id];
+	}
+	return 0;
+}
+
+void zlabAssetRelease( int id ) {
+	if( id > 0 && id < assetsAlloc && assets[id] ) {
+		assert( assets[id]->refCount > 0 );
+		assets[id]->refCount--;
+	}
+}
+
+void zlabAssetsSetCacheLimit( size_t bytes ) {
+	assetCacheLimit = bytes;
+}
+
+static void assetsEvictOverLimit() {
+	size_t total = 0;
+	int i;
+	for( i=1; i<assetsAlloc; i++ ) {
+		ZlabAsset *a = assets[i];
+		if( a && !a->inFlight && a->state == ZLAB_ASSET_FAILED && a->refCount == 0 ) {
+			// EVICT released failures at once; they are never reused and cost
+			// nothing, so the limit would not otherwise clear them out.  One
+			// still in flight may be linked in a queue, so wait for it.
+			assetEvict( a );
+		}
+		else if( a && a->state == ZLAB_ASSET_READY ) {
+			total += assetBytes( a );
+				// in-flight assets still belong to the threads
+		}
+	}
+	while( total > assetCacheLimit ) {
+		ZlabAsset *oldest = 0;
+		for( i=1; i<assetsAlloc; i++ ) {
+			ZlabAsset *a = assets[i];
+			if( a && a->refCount == 0 && a->state == ZLAB_ASSET_READY ) {
+				if( !oldest || a->lastUsed < oldest->lastUsed ) {
+					oldest = a;
+				}
+			}
+		}
+		if( !oldest ) {
+			// Everything left is in use or in flight
+			break;
+		}
+		total -= assetBytes( oldest );
+		assetEvict( oldest );
+	}
+}
+
+void zlabAssetsMaintain( double uploadBudgetSecs ) {
+	if( !assetsAlloc ) {
+		return;
+	}
+	double start = zTimeNow();
+
+	#ifdef ZMSG_MULTITHREAD
+	if( !threadsRunning )
+	#endif
+	{
+		// LOAD one file synchronously when there are no threads
+		ZlabAsset *a = queuePop( ioHead, ioTail );
+		if( a ) {
+			int ok = assetRead( a ) && assetDecode( a );
+			a->state = ok ? ZLAB_ASSET_UPLOADING : ZLAB_ASSET_FAILED;
+			queuePush( doneHead, doneTail, a );
+		}
+	}
+
+	// COLLECT what the threads have finished
+	ASSET_LOCK();
+	while( ZlabAsset *a = queuePop( doneHead, doneTail ) ) {
+		a->next = uploadHead;
+		uploadHead = a;
+	}
+	ASSET_UNLOCK();
+
+	// UPLOAD within the time budget; always make some progress
+	ZlabAsset **prev = &uploadHead;
+	int uploads = 0;
+	while( *prev ) {
+		ZlabAsset *a = *prev;
+		if( a->state == ZLAB_ASSET_UPLOADING && a->callbacks.upload ) {
+			if( uploads > 0 && zTimeNow() - start > uploadBudgetSecs ) {
+				// LEAVE it for next frame, but keep going to finish the
+				// assets that need no upload
+				prev = &a->next;
+				continue;
+			}
+			uploads++;
+			if( !(*a->callbacks.upload)( a ) ) {
+				prev = &a->next;
+				continue;
+			}
+		}
+		if( a->state == ZLAB_ASSET_UPLOADING ) {
+			a->state = ZLAB_ASSET_READY;
+		}
+		*prev = a->next;
+		a->next = 0;
+		assetNotify( a );
+		a->inFlight = 0;
+	}
+
+	assetsEvictOverLimit();
+}
+
+void zlabAssetsShutdown() {
+	#ifdef ZMSG_MULTITHREAD
+	if( threadsRunning ) {
+		ASSET_LOCK();
+		threadsQuit = 1;
+		ioHead = ioTail = 0;
+		decodeHead = decodeTail = 0;
+			// abandon work not yet started; those assets are freed below
+		pthread_cond_broadcast( &ioCond );
+		pthread_cond_broadcast( &decodeCond );
+		ASSET_UNLOCK();
+		pthread_join( ioThread, 0 );
+		for( int i=0; i<decodeThreadCount; i++ ) {
+			pthread_join( decodeThreads[i], 0 );
+		}
+		threadsRunning = 0;
+	}
+	#endif
+
+	for( int i=1; i<assetsAlloc; i++ ) {
+		if( assets[i] ) {
+			assetEvict( assets[i] );
+		}
+	}
+	free( assets );
+	assets = 0;
+	assetsAlloc = 0;
+	uploadHead = 0;
+	ioHead = ioTail = decodeHead = decodeTail = doneHead = doneTail = 0;
+}
@@ -0,0 +1,103 @@
+#ifndef ZLABASSETS_H
+#define ZLABASSETS_H
+
+// Asynchronous asset loading for plugins.
+//
+// A plugin asks for a file with zlabAssetRequest() and gets back an id at once.
+// The file is read on an I/O thread (mapped where the OS allows it), handed to
+// the optional decode callback on a worker thread, and then given to the
+// optional upload callback on the main thread, where GL calls are legal.  The
+// upload callback is called once per frame until it reports that it is done,
+// within a per-frame time budget, so that a big upload can be spread over
+// several frames.  When the asset is ready (or has failed) the message given
+// to the request is queued with "assetId=<id>" appended, e.g.
+//
+//   zlabAssetRequest( pluginPath( "terrain.raw" ), &terrainCallbacks, "type=Kin_TerrainLoaded" );
+//
+// Finished assets stay in a bounded cache keyed by path, so asking for the same
+// file again (e.g. after switching plugins and back) completes without I/O.
+// Release an asset when done with it; released assets are evicted least
+// recently used first once the cache is over its limit.
+//
+// The functions below are for the main thread only.  Without ZMSG_MULTITHREAD
+// the loading is done on the main thread too, from zlabAssetsMaintain(), one
+// file per frame.
+
+#include "stddef.h"
+
+struct ZlabAsset;
+struct ZlabAssetWaiter;
+
+struct ZlabAssetCallbacks {
+	int (*decode)( ZlabAsset *asset );
+		// Worker thread.  Turn asset->data/size into asset->decoded/decodedSize.
+		// Return 0 on failure.  May be 0 if the raw file is what is wanted.
+	int (*upload)( ZlabAsset *asset );
+		// Main thread, with a current GL context.  Return 1 when finished, 0 to
+		// be called again next frame.  May be 0.
+	void (*release)( ZlabAsset *asset );
+		// Main thread, when the asset is evicted (in any state, check
+		// asset->state).  Free asset->decoded and any GL objects.
+		// If 0, asset->decoded is free()d.
+	void *user;
+};
+
+enum ZlabAssetState {
+	ZLAB_ASSET_QUEUED = 0,
+	ZLAB_ASSET_LOADING,
+	ZLAB_ASSET_DECODING,
+	ZLAB_ASSET_UPLOADING,
+	ZLAB_ASSET_READY,
+	ZLAB_ASSET_FAILED
+};
+
+struct ZlabAsset {
+	int id;
+	char path[512];
+	volatile int state;
+	ZlabAssetCallbacks callbacks;
+
+	char *data;
+	size_t size;
+		// the file contents, read only; 0 for an empty or missing file
+	void *decoded;
+	size_t decodedSize;
+		// filled in by the decode callback
+	unsigned int glName;
+	void *uploadState;
+		// for the upload callback's own use
+
+	// Private
+	ZlabAssetWaiter *waiters;
+	int refCount;
+	int mapped;
+	int inFlight;
+		// from the request until it leaves the upload list; main thread only,
+		// the threads never look at it
+	unsigned int lastUsed;
+	ZlabAsset *next;
+};
+
+int zlabAssetRequest( char *path, ZlabAssetCallbacks *callbacks=0, char *doneMsg=0 );
+	// Returns an asset id (> 0) with one reference held by the caller.
+	// callbacks is copied.  A cached asset with the same path is reused;
+	// its callbacks are the ones it was first requested with.
+
+ZlabAsset *zlabAssetGet( int id );
+	// 0 if the id is unknown or has been evicted
+
+void zlabAssetRelease( int id );
+	// Drop a reference; the asset may then be evicted
+
+void zlabAssetsSetCacheLimit( size_t bytes );
+	// Default 256 MB, counted as file size plus decodedSize.  Failed assets
+	// are evicted as soon as they are released.
+
+void zlabAssetsMaintain( double uploadBudgetSecs );
+	// Main thread, once per frame: runs upload callbacks until the budget is
+	// used, queues completion messages and evicts over the cache limit.
+
+void zlabAssetsShutdown();
+	// Stops the threads and releases every asset
+
+#endif
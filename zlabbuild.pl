@@ -3,6 +3,9 @@ use File::Spec;
 use File::Copy 'move';
 use File::Path 'rmtree';
 use File::Basename 'fileparse';
+use File::Compare 'compare';
+use Storable qw( nstore retrieve );
+use Digest::MD5;
 
 use lib "./lib";
 use Amazon::S3;
@@ -39,8 +42,33 @@ $verbose = 0;
 # e.g. python zlabbuild.pl nozip
 $nozip = 0;
 
+# SET cleanBuild to delete all objects before every build rather than only
+# rebuilding what changed; may be set with ZLAB_CLEAN_BUILD or from the
+# command-line, e.g. perl zlabbuild.pl kin_pro clean
+$cleanBuild = $ENV{ZLAB_CLEAN_BUILD} ? 1 : 0;
+if( grep { $_ eq 'clean' } @ARGV ) {
+	$cleanBuild = 1;
+	@ARGV = grep { $_ ne 'clean' } @ARGV;
+}
+
 # FIND platform
 $platform = determinePlatform();
+
+# SET the number of parallel compile jobs.  Defaults to the number of cores,
+# may be overridden with the ZLAB_BUILD_JOBS environment variable.
+$buildJobs = $ENV{ZLAB_BUILD_JOBS} ? int( $ENV{ZLAB_BUILD_JOBS} ) : numProcessors();
+
+# SET the package upload destination.  When ZLAB_S3_BUCKET is set, release
+# packages are uploaded by s3UploadResumable() rather than kinUploadToS3(); see
+# S3 UPLOAD below for the other ZLAB_S3_ variables.
+$s3Bucket = $ENV{ZLAB_S3_BUCKET};
+
+# SET the build profile, see BUILD PROFILES below
+$buildProfile = $ENV{ZLAB_BUILD_PROFILE} ? $ENV{ZLAB_BUILD_PROFILE} : 'release';
+
+# SET the number of unity (jumbo) translation units, 0 for a normal per-file
+# build.  See unityGroupFiles().  May be set with ZLAB_UNITY_TUS.
+$unityBuild = $ENV{ZLAB_UNITY_TUS} ? int( $ENV{ZLAB_UNITY_TUS} ) : 0;
 my $svnRev = svnRevision();
 	# In the case we're using git, the YYYYMMDD date value will be returned for svnRev.
 	# This can be used as a buildstamp e.g. version Major.Minor.svnRev.  This was done
@@ -262,6 +290,85 @@ sub config_stopflow_zfit {
 	}
 }
 
+
+####################################################################################################
+#
+# BUILD PROFILES
+#
+####################################################################################################
+
+# A build profile selects the optimization flags used for the Release build,
+# independent of the config.  Each profile_ function sets the extra compile and
+# link flags for gcc/clang (linux, macosx) and for msvc (win32).  The selected
+# profile is saved in zlabbuild.cfg and recorded in core/buildinfo.txt of the package.
+# It may also be given by the ZLAB_BUILD_PROFILE environment variable for automated builds.
+
+@buildProfileNames = ( 'release', 'release_lto', 'pgo_instrument', 'pgo_use', 'native' );
+
+sub profile_release {
+	$profileDescription = "Standard optimized build";
+}
+
+sub profile_release_lto {
+	$profileDescription = "Link-time optimization";
+	my $lto = $platform eq 'linux' ? "-flto=$buildJobs" : "-flto";
+		# clang only accepts -flto or -flto=thin
+	$profileGccFlags = $lto;
+	$profileGccLinkFlags = "$lto -O3";
+	$profileWin32Flags = "/GL";
+	$profileWin32LinkFlags = "/LTCG";
+}
+
+sub profile_pgo_instrument {
+	# Instrumented binary: run a benchmark or replay session with it and the
+	# profile data is written to $pgoDir for use by the pgo_use profile.
+	$profileDescription = "Profile-guided optimization, instrumented (writes profiles to $pgoDir)";
+	mkdir( $pgoDir );
+	$profileGccFlags = "-fprofile-generate=$pgoDir";
+	$profileGccLinkFlags = "-fprofile-generate=$pgoDir";
+	$profileWin32Flags = "/GL";
+	$profileWin32LinkFlags = "/LTCG:PGINSTRUMENT /PGD:\"$pgoDir/zlab.pgd\"";
+}
+
+sub profile_pgo_use {
+	$profileDescription = "Profile-guided optimization, using profiles in $pgoDir";
+	my $pgoData = $pgoDir;
+	if( $platform eq 'macosx' ) {
+		# clang writes .profraw files which must be merged first:
+		#   xcrun llvm-profdata merge -output=$pgoDir/zlab.profdata $pgoDir/*.profraw
+		$pgoData = "$pgoDir/zlab.profdata";
+	}
+	my @profiles = glob( "$pgoDir/*" );
+	if( ! -e $pgoData || ! @profiles ) {
+		print "  *** WARNING: no profile data found in $pgoDir; build and run the pgo_instrument profile first.\n";
+	}
+	$profileGccFlags = "-fprofile-use=$pgoData -fprofile-correction -Wno-missing-profile";
+	$profileGccLinkFlags = "-fprofile-use=$pgoData";
+	$profileWin32Flags = "/GL";
+	$profileWin32LinkFlags = "/LTCG:PGOPTIMIZE /PGD:\"$pgoDir/zlab.pgd\"";
+}
+
+sub profile_native {
+	# Only for binaries that will run on the machine that built them (or identical CPUs)
+	$profileDescription = "Optimized for the CPU of this build machine";
+	$profileGccFlags = "-march=native -mtune=native";
+	$profileWin32Flags = "/arch:AVX2";
+}
+
+sub profileApply {
+	$profileDescription = '';
+	$profileGccFlags = '';
+	$profileGccLinkFlags = '';
+	$profileWin32Flags = '';
+	$profileWin32LinkFlags = '';
+	$pgoDir = "$buildDir/pgo";
+	if( ! defined &{'profile_' . $buildProfile} ) {
+		print "  *** Unknown build profile '$buildProfile', using 'release'\n";
+		$buildProfile = 'release';
+	}
+	&{'profile_' . $buildProfile}();
+}
+
 sub configClear {
 	$configName = 'none';
 	@configDefines = ();
@@ -283,6 +390,8 @@ sub configSave {
 	print FILE "interface = '$configInterface'\n";
 	print FILE "plugins = '" . (join ",", @configPlugins) . "'\n";
 	print FILE "configName = '$configName'\n";
+	print FILE "buildProfile = '$buildProfile'\n";
+	print FILE "unityBuild = '$unityBuild'\n";
 	close( FILE );
 }
 
@@ -300,8 +409,16 @@ sub configLoad {
 		if( /configName = '(.*)'/ ) {
 			$configName = $1;
 		}
+		if( /buildProfile = '(.*)'/ ) {
+			$buildProfile = $1;
+		}
+		if( /unityBuild = '(.*)'/ ) {
+			$unityBuild = int( $1 );
+		}
 	}
 	close( FILE );
+	$buildProfile = $ENV{ZLAB_BUILD_PROFILE} if( $ENV{ZLAB_BUILD_PROFILE} );
+	$unityBuild = int( $ENV{ZLAB_UNITY_TUS} ) if( $ENV{ZLAB_UNITY_TUS} );
 }
 
 sub createMakeFileCleanBuildPackage() {
@@ -413,7 +530,12 @@ if( $ARGV[0] ) {
 		foreach my $f ( @uploadFiles ) {
 			my $start = time();
 			print( "Uploading $f ...\n" );
-			kinUploadToS3( $f );
+			if( $s3Bucket ) {
+				s3UploadResumable( $f ) || die "\n***\n*** ERROR: upload of $f failed; run again to resume.\n***\n";
+			}
+			else {
+				kinUploadToS3( $f );
+			}
 			my $elapsed = time() - $start;
 			print( "  --> $elapsed seconds.\n" );
 		}
@@ -457,6 +579,9 @@ while( 1 ) {
 	print "  Selected Config Name:\n";
 	print "    $configName\n";
 	print "  Platform: $platformDesc (ver=$devVersion)\n";
+	print "  Parallel build jobs: $buildJobs\n";
+	print "  Build profile: $buildProfile\n";
+	print "  Unity build: " . ( $unityBuild ? "$unityBuild translation units" : "off" ) . "\n";
 	print "  Directories:\n";
 	print "    sdkDir   : $sdkDir\n";
 	print "    zbslibDir: $zbslibDir\n";
@@ -610,6 +735,21 @@ while( 1 ) {
 			configSave();
 		},
 
+		"Select a build profile (optimization flags for release builds)" => sub {
+			my %profiles;
+			map { $profiles{$_} = $_ eq $buildProfile ? 1 : 0 } @buildProfileNames;
+			%profiles = radioMenu( %profiles );
+			map { $buildProfile = $_ if $profiles{$_} } keys %profiles;
+			configSave();
+		},
+
+		"Set unity build translation unit count (0 = off)" => sub {
+			print "Number of unity translation units (0 for a normal per-file build): ";
+			my $n = <STDIN>;
+			$unityBuild = int( $n ) > 0 ? int( $n ) : 0;
+			configSave();
+		},
+
 		"Compile and test all necessary SDKs (all SDKS must be built before build)" => sub {
 			&compileAndTestSDKsInOrder( @configUsedSDKs );
 			print "Press ENTER key to continue.\n";
@@ -725,6 +865,10 @@ sub analyzeUsedFiles {
 	# This function scans the directories for plugins and 
 	# does a full analysis of all files to determine which files and SDK are needed
 
+	zbsScanCacheLoad();
+		# the per-file scan results are cached by mtime in the build folder so that
+		# only files that changed since the last analysis are actually read
+
 	#
 	# SCAN plugins
 	#
@@ -959,12 +1103,54 @@ sub analyzeUsedFiles {
 		print "\n";
 	}
 
-	
+	zbsScanCacheSave();
+}
+
+sub zbsScanCacheLoad {
+	# LOAD the results of previous file scans; see zbsScanCacheEntry()
+	return if( $zbsScanCacheLoaded );
+	$zbsScanCacheLoaded = 1;
+	%zbsScanCache = ();
+	my $cacheFile = "$buildDir/zbsscan.cache";
+	if( -f $cacheFile ) {
+		my $cache = eval { retrieve( $cacheFile ) };
+		if( $cache && $cache->{version} == 1 ) {
+			%zbsScanCache = %{ $cache->{files} };
+		}
+	}
+	$zbsScanCacheDirty = 0;
+}
+
+sub zbsScanCacheSave {
+	return if( ! $zbsScanCacheDirty );
+	eval { nstore( { version => 1, files => { %zbsScanCache } }, "$buildDir/zbsscan.cache" ) };
+	print "Unable to write scan cache: $@\n" if( $@ && $verbose );
+	$zbsScanCacheDirty = 0;
+}
+
+sub zbsScanCacheEntry {
+	# Returns the cache entry for a file.  The entry holds the ZBS record
+	# (zbsModuleReadRecord) and the include/ZBSIF lines (zbsModuleScanDirectDepends)
+	# for the file; it is emptied whenever the file's mtime or size changes.
+	my( $filename ) = @_;
+	my( $size, $mtime ) = ( stat( $filename ) )[7,9];
+	my $entry = $zbsScanCache{ $filename };
+	if( !$entry || $entry->{mtime} != $mtime || $entry->{size} != $size ) {
+		$entry = { mtime => $mtime, size => $size };
+		$zbsScanCache{ $filename } = $entry;
+		$zbsScanCacheDirty = 1;
+	}
+	return $entry;
 }
 
 sub zbsModuleReadRecord {
 	my( $filename ) = @_;
 
+	my $cacheEntry = zbsScanCacheEntry( $filename );
+	if( $cacheEntry->{record} ) {
+		return %{ $cacheEntry->{record} };
+	}
+
 	my %hash;
 	my $text;
 	open( F, $filename );
@@ -997,6 +1183,9 @@ sub zbsModuleReadRecord {
 	close( F );
 	$hash{FILENAME} = ( $filename );
 
+	$cacheEntry->{record} = { %hash };
+	$zbsScanCacheDirty = 1;
+
 	return %hash;
 }
 
@@ -1057,38 +1246,61 @@ sub zbsModuleScanDirectDepends {
 
 	my @moduleDepends;
 
+	#
+	# READ the include and ZBSIF lines of this file, unless they are cached from an earlier scan
+	#
+	my $cacheEntry = zbsScanCacheEntry( $file );
+	if( ! $cacheEntry->{directives} ) {
+		my @directives;
+		open( FILE, $file );
+		while( <FILE> ) {
+			if( /^\/\/\s*\@ZBSIF\s+(.*)/ ) {
+				push @directives, [ 'if', $1 ];
+			}
+			elsif( /^\/\/\s*\@ZBSENDIF/ ) {
+				push @directives, [ 'endif' ];
+			}
+			elsif( /^\s*#include [\"<](.*)[\">]/ ) {
+				push @directives, [ 'include', $1 ];
+			}
+		}
+		close( FILE );
+		$cacheEntry->{directives} = [ @directives ];
+		$zbsScanCacheDirty = 1;
+	}
+
 	#
 	# SCAN the header includes for this file pulling in any modules which are required by that header
 	#
-	open( FILE, $file );
-	while( <FILE> ) {
-		if( /^\/\/\s*\@ZBSIF\s+(.*)/ ) {
-			# A header include option has been found. Read the line and evaluate it, if true include the contents otherwise skip
-			if( ! eval($1) ) {
-				print "Skipping section because $1 evals to false\n" if $verbose;
+	foreach( @{ $cacheEntry->{directives} } ) {
+		my( $type, $arg ) = @$_;
+		if( $type eq 'if' ) {
+			# A header include option has been found. Evaluate it, if true include the contents otherwise skip.
+			# This is evaluated every time since it depends on the current config.
+			if( ! eval($arg) ) {
+				print "Skipping section because $arg evals to false\n" if $verbose;
 				$skipping = 1;
 			}
 			else {
-				print "Including section because $1 evals to true\n" if $verbose;
+				print "Including section because $arg evals to true\n" if $verbose;
 
 			}
 		}
-		elsif( /^\/\/\s*\@ZBSENDIF/ ) {
+		elsif( $type eq 'endif' ) {
 			$skipping = 0;
 		}
-		elsif( !$skipping && /^\s*#include [\"<](.*)[\">]/ ) {
-			#if( $zbsModuleByHeader{ lc($1) } ) {
-			 if( $zbsModuleByHeader{   ($1) } ) {
+		elsif( !$skipping ) {
+			#if( $zbsModuleByHeader{ lc($arg) } ) {
+			 if( $zbsModuleByHeader{   ($arg) } ) {
 				# removed lowercase for linux compat TFB 26 Mar 2008
 				# Found a module, include all of its required files
 				if( $verbose ) {
-					print "From $file with header $1, adding: @{$zbsModuleRecords{ $zbsModuleByHeader{ $1 } }{REQUIRED_FILES}}\n";
+					print "From $file with header $arg, adding: @{$zbsModuleRecords{ $zbsModuleByHeader{ $arg } }{REQUIRED_FILES}}\n";
 				}
-				push @moduleDepends, @{$zbsModuleRecords{ $zbsModuleByHeader{ $1 } }{REQUIRED_FILES}};
+				push @moduleDepends, @{$zbsModuleRecords{ $zbsModuleByHeader{ $arg } }{REQUIRED_FILES}};
 			}
 		}
 	}
-	close( FILE );
 
 	#
 	# ADD the explicit depends that are listed by the ZBS record
@@ -1115,7 +1327,9 @@ sub zbsModuleScanDirectDepends {
 ####################################################################################################
 
 sub createMakeFileAndOptionallyBuild {
-	my( $build ) = @_;
+	my( $build, $unityRetry ) = @_;
+	my @configDefinesIn = @configDefines;
+		# restored for a unity fallback rebuild, see BUILD below
 
 	# EXTRACT the used files into the globals @configUsedFiles and @configUsedSDKs
 	analyzeUsedFiles();
@@ -1124,6 +1338,11 @@ sub createMakeFileAndOptionallyBuild {
 	my @fullFilenames;
 	map { push @fullFilenames, $zbsModuleRecords{$_}{FILENAME} } @configUsedFiles;
 
+	# COMBINE the .cpp files into jumbo translation units if requested
+	if( $unityBuild ) {
+		@fullFilenames = unityGroupFiles( @fullFilenames );
+	}
+
 
 	# INCLUDE all of the manually requested libs
 	my @win32debuglibs;
@@ -1158,6 +1377,8 @@ sub createMakeFileAndOptionallyBuild {
 	if( $configPackageName ) {
 		print "Building configured package $configPackageName ...\n";
 	}
+	profileApply();
+	print "Build profile: $buildProfile ($profileDescription)\n";
 	platform_createMakefile(
 		name => $configPackageName ? $configPackageName : 'zlab',
 		files => [ sort @fullFilenames ],
@@ -1174,6 +1395,10 @@ sub createMakeFileAndOptionallyBuild {
 		linuxlibs => [ @linuxlibs, @linuxInterfaceLibs ],
 		macosxdefines => [ @configDefines ],
 		macosxlibs => [ @macosxlibs, @macosxInterfaceLibs ],
+		gccflags => $profileGccFlags,
+		gcclinkflags => $profileGccLinkFlags,
+		win32releaseflags => $profileWin32Flags,
+		win32releaselinkflags => $profileWin32LinkFlags,
 		interface => $configInterface,
 	);
 	
@@ -1198,15 +1423,33 @@ sub createMakeFileAndOptionallyBuild {
 	close OPTIONS;
 
 	#
-	# CLEAN
+	# CLEAN only when asked to or when the compile flags have changed since the
+	# last build; otherwise make rebuilds just the objects whose sources or
+	# headers (tracked in the .d files) have changed
 	#
-	recursiveUnlink( 'Debug' );
-	recursiveUnlink( 'Release' );
-	recursiveUnlink( 'zlab.app' );  #osx
-	my $ret = platform_runMakefile( win64name=>'zlab.vcxproj', win32name=>'zlab.vcproj', linuxname=>'Makefile', macosxname=>'Makefile', target=>'clean', win32config=>'Debug' );
-	print "make clean debug FAILURE\n" if( !$ret );
-	my $ret = platform_runMakefile( win64name=>'zlab.vcxproj', win32name=>'zlab.vcproj', linuxname=>'Makefile', macosxname=>'Makefile', target=>'clean', win32config=>'Release' );
-	print "make clean release FAILURE\n" if( !$ret );
+	my $buildStamp = join( "\n", $platform, $configName, $buildProfile, $unityBuild, $profileGccFlags, $profileGccLinkFlags, $profileWin32Flags, $profileWin32LinkFlags, @configDefines, "SVN_REV=$svnRev" ) . "\n";
+	my $buildStampFile = "$buildDir/buildstamp.txt";
+	my $lastBuildStamp = '';
+	if( open( STAMP, $buildStampFile ) ) {
+		local $/;
+		$lastBuildStamp = <STAMP>;
+		close( STAMP );
+	}
+	my $ret;
+	if( $cleanBuild || $buildStamp ne $lastBuildStamp ) {
+		print "Cleaning" . ( $cleanBuild ? "" : " (compile flags changed)" ) . "...\n";
+		recursiveUnlink( 'Debug' );
+		recursiveUnlink( 'Release' );
+		recursiveUnlink( 'zlab.app' );  #osx
+		$ret = platform_runMakefile( win64name=>'zlab.vcxproj', win32name=>'zlab.vcproj', linuxname=>'Makefile', macosxname=>'Makefile', target=>'clean', win32config=>'Debug' );
+		print "make clean debug FAILURE\n" if( !$ret );
+		$ret = platform_runMakefile( win64name=>'zlab.vcxproj', win32name=>'zlab.vcproj', linuxname=>'Makefile', macosxname=>'Makefile', target=>'clean', win32config=>'Release' );
+		print "make clean release FAILURE\n" if( !$ret );
+	}
+	if( open( STAMP, ">$buildStampFile" ) ) {
+		print STAMP $buildStamp;
+		close( STAMP );
+	}
 
 	#
 	# BUILD
@@ -1215,6 +1458,12 @@ sub createMakeFileAndOptionallyBuild {
 		print "Building...\n";
 
 		$ret = platform_runMakefile( win64name=>'zlab.vcxproj', win32name => 'zlab.vcproj', linuxname => 'Makefile', macosxname => 'Makefile', win32config => 'Release' );
+		if( !$ret && $unityBuild && !$unityRetry && unityFindFailedGroups() ) {
+			# REBUILD with the modules of the units that failed compiled on their own
+			print "Rebuilding with those modules compiled separately...\n";
+			@configDefines = @configDefinesIn;
+			return createMakeFileAndOptionallyBuild( $build, 1 );
+		}
 		print $ret ? "make release success\n" : "make FAILURE\n";
 	}
 
@@ -1247,6 +1496,122 @@ sub createMakeFileAndOptionallyBuild {
 	#return status of build, if we tried to build
 }
 
+sub unityGroupFiles {
+	# Given the full list of files for the build, writes $unityBuild unity .cpp
+	# files to build/unity that each #include a share of the .cpp modules, and
+	# returns the list of files to build instead: the unity files plus every
+	# file that must still be compiled on its own.  Those are .c files (compiled
+	# as C), headers, and any module that does not combine cleanly with others,
+	# which is marked in its ZBS record with:
+	#		*UNITY_BUILD no
+	# Plugin main files (_name.cpp) are always compiled on their own since they
+	# each define the same plugin entry point names.  So are the modules listed
+	# in build/unity/separate.txt, which unityFindFailedGroups() adds to when a
+	# unit fails to compile; delete that file to try combining them again.
+	my @files = @_;
+
+	my %unitySeparate;
+	if( open( SEPARATE, "$buildDir/unity/separate.txt" ) ) {
+		while( <SEPARATE> ) {
+			chomp;
+			$unitySeparate{$_} = 1 if( $_ ne '' );
+		}
+		close( SEPARATE );
+	}
+
+	my @unityFiles;
+	my @separateFiles;
+	foreach my $file( @files ) {
+		my $module = (fparse( $file ))[2] . (fparse( $file ))[3];
+		my $unityOpt = $zbsModuleRecords{$module}{UNITY_BUILD}->[0];
+		if( $file !~ /\.cpp$/ || $module =~ /^_/ || $module eq 'filedialog_native.cpp' || $unityOpt eq 'no' || $unitySeparate{$module} ) {
+			# filedialog_native.cpp is swapped for a .mm file by macosx_createMakefile
+			push @separateFiles, $file;
+		}
+		else {
+			push @unityFiles, $file;
+		}
+	}
+	return @files if( ! @unityFiles );
+	@unityFiles = sort @unityFiles;
+
+	# SPLIT the modules into groups of about equal size, keeping neighbouring
+	# (same folder) files together so that they share the most headers
+	my $count = $unityBuild < scalar( @unityFiles ) ? $unityBuild : scalar( @unityFiles );
+	my $totalSize = 0;
+	map { $totalSize += -s $_ } @unityFiles;
+	my @groups;
+	my $group = 0;
+	my $groupSize = 0;
+	foreach my $file( @unityFiles ) {
+		if( $groupSize > 0 && $groupSize >= $totalSize / $count && $group < $count-1 ) {
+			$group++;
+			$groupSize = 0;
+		}
+		push @{ $groups[$group] }, $file;
+		$groupSize += -s $file;
+	}
+
+	my $unityDir = "$buildDir/unity";
+	mkdir( $unityDir );
+	my @unitySources;
+	%unityGroups = ();
+	for( my $i=0; $i<scalar( @groups ); $i++ ) {
+		my $unityName = "$unityDir/zlab_unity_$i.cpp";
+		$unityGroups{$unityName} = $groups[$i];
+		open( UNITY, ">$unityName.new" );
+		print UNITY "// Generated by zlabbuild.pl for unity builds; do not edit.\n";
+		foreach( @{ $groups[$i] } ) {
+			my $file = $_;
+			$file =~ tr#\\#/#;
+			print UNITY "#include \"$file\"\n";
+		}
+		close( UNITY );
+		replaceFileIfChanged( "$unityName.new", $unityName );
+		push @unitySources, $unityName;
+	}
+	for( my $i=scalar( @groups ); -f "$unityDir/zlab_unity_$i.cpp"; $i++ ) {
+		# REMOVE units left over from a build that used more of them
+		unlink( "$unityDir/zlab_unity_$i.cpp" );
+	}
+	print "Unity build: " . scalar( @unityFiles ) . " modules in " . scalar( @groups ) . " units, " . scalar( @separateFiles ) . " files built separately\n";
+	return ( @unitySources, @separateFiles );
+}
+
+sub unityObjectFile {
+	my( $unitySource ) = @_;
+	if( $platform eq 'win32' ) {
+		my $name = (fparse( $unitySource ))[2];
+		return "$buildDir/Release/$name.obj";
+	}
+	my $object = $unitySource;
+	$object =~ s/\.cpp$/.o/;
+	return $object;
+}
+
+sub unityFindFailedGroups {
+	# After a failed unity build, finds which units failed by building them all
+	# again (keeping going past errors) and seeing which produced no object.
+	# Adds the modules of those units to build/unity/separate.txt and returns
+	# how many units failed.
+	print "Unity build failed, finding the units that did not compile...\n";
+	map { unlink( unityObjectFile( $_ ) ) } keys %unityGroups;
+	platform_runMakefile( win64name=>'zlab.vcxproj', win32name => 'zlab.vcproj', linuxname => 'Makefile', macosxname => 'Makefile', win32config => 'Release', keepgoing => 1 );
+
+	my @failed = grep { ! -f unityObjectFile( $_ ) } sort keys %unityGroups;
+	return 0 if( ! @failed );
+	open( SEPARATE, ">>$buildDir/unity/separate.txt" );
+	foreach my $unitySource( @failed ) {
+		foreach( @{ $unityGroups{$unitySource} } ) {
+			my $module = (fparse( $_ ))[2] . (fparse( $_ ))[3];
+			print "  $module\n";
+			print SEPARATE "$module\n";
+		}
+	}
+	close( SEPARATE );
+	return scalar( @failed );
+}
+
 sub createSignedDmg {
 	my $dstDir = shift;
 	my $basePackageName = shift;
@@ -1388,16 +1753,11 @@ sub packageZlab() {
 	my $dstDir = $configPackageTo ? $configPackageTo : "./zlab_package_$platformDesc";
 
 	#
-	# CLEAR the dst folder
+	# UPDATE the dst folder in place: cp() into it only copies files whose
+	# content changed since the last package, see packageCp()
 	#
 	print "Packaging to $dstDir\n";
-	recursiveUnlink( $dstDir );
-	if( -d $dstDir ) {
-		print "\n* PACKAGING ERROR: The destination folder $dstDir could not be removed!\n";
-		print "  Ensure you aren't using this folder or its subfolders in any way, such\n";
-		print "  as viewing them in Explorer, or running a program that lives within.\n\n";
-		exit;
-	}
+	packageManifestBegin( $dstDir );
 	mkdir( $dstDir );
 	
 	$coreDir = "$dstDir/core";
@@ -1498,6 +1858,19 @@ sub packageZlab() {
 		close( F );
 	}
 
+	#
+	# RECORD how this package was built
+	#
+	open( F, ">$coreDir/buildinfo.txt" );
+	print F "config = $configName\n";
+	print F "platform = $platformDesc\n";
+	print F "buildDate = $buildDate\n";
+	print F "gitRev = $gitRev\n";
+	print F "buildProfile = $buildProfile\n";
+	print F "buildProfileDescription = $profileDescription\n";
+	print F "buildProfileFlags = " . ( $platform eq 'win32' ? "$profileWin32Flags $profileWin32LinkFlags" : "$profileGccFlags $profileGccLinkFlags" ) . "\n";
+	close( F );
+
 	# RUN configuration specific copy
 	if( defined &{'config_' . $configName} ) {
 		&{'config_' . $configName}( 0, $dstDir );
@@ -1543,6 +1916,8 @@ sub packageZlab() {
 		}
 	}
 
+	packageManifestEnd();
+
 	#
 	# COMPRESS
 	#
@@ -1560,12 +1935,18 @@ sub packageZlab() {
 		$packageName .= "_" . $platformDesc if !$packageName !~ /$platformDesc/;
 		$packageName .= ".tar.gz";
 		unlink( $packageName );
-		my $compressCmd = "tar -pczf $packageName $dstDir 2> /dev/null";
+		my $tarSrc = $dstDir;
 		my( $volume, $directories, $file ) = File::Spec->splitpath( $dstDir );
 		if( $directories ne "" && $file ne "" ) {
-			$compressCmd = "tar -C $directories -pczf $packageName $file 2> /dev/null";
+			$tarSrc = "-C $directories $file";
 				# cause the tar file to only contain the leaf node of the path
 		}
+		my $compressCmd = "tar -pczf $packageName $tarSrc 2> /dev/null";
+		my $pigz = findExecutable( 'pigz' );
+		if( $pigz ) {
+			# COMPRESS on all cores; the output is an ordinary gzip stream
+			$compressCmd = "tar -pcf - $tarSrc 2> /dev/null | \"$pigz\" -p $buildJobs > $packageName";
+		}
 		`$compressCmd`;
 		if (-s "$packageName") {
 			printf "Distribution created: $packageName ( $compressCmd )\n";
@@ -1599,6 +1980,14 @@ sub packageZlab() {
 		$packageName .= ".zip";
 		unlink( $packageName );
 		my $compressCmd = "$zlabDir/tools/zip.exe -rq $packageName $dstDir"; 
+		my $sevenZip = findExecutable( '7z' );
+		if( !$sevenZip && -f "$ENV{ProgramFiles}/7-Zip/7z.exe" ) {
+			$sevenZip = "$ENV{ProgramFiles}/7-Zip/7z.exe";
+		}
+		if( $sevenZip ) {
+			# COMPRESS on all cores; 7z deflates zip entries in parallel
+			$compressCmd = "\"$sevenZip\" a -tzip -mmt=$buildJobs -bd $packageName $dstDir > NUL";
+		}
 		`$compressCmd`;
 		if( -s "$packageName" ) {
 			printf "Distribution created: $packageName ( $compressCmd )\n";
@@ -1612,6 +2001,316 @@ sub packageZlab() {
 }
 
 
+####################################################################################################
+#
+# INCREMENTAL PACKAGING
+#
+# Between packageManifestBegin() and packageManifestEnd() every cp() into the
+# package folder goes through packageCp(), which skips files whose content is
+# already there.  The manifest, kept beside the package folder, records the MD5
+# of each file copied together with the source size/mtime (so unchanged sources
+# aren't even re-read) and the destination mtime (so that a file changed in the
+# package, e.g. by code signing, is copied again).
+#
+# Only files in the manifest are kept from one package to the next.  Anything
+# else in the folder (written directly, e.g. options.cfg or a config's data
+# copy) is deleted up front and so must be written again, and the whole folder
+# is wiped if the manifest belongs to another config.  A folder that exists
+# without a readable manifest was not made by this packager, so packaging stops
+# rather than delete anything in it, as it does when files can't be removed.
+#
+####################################################################################################
+
+$packageDir = '';
+%packageManifest = ();
+%packageTouched = ();
+
+sub packagePath {
+	# Normalize a path so that ones naming the same file in the package compare equal
+	my( $path ) = @_;
+	$path =~ s/\\/\//g;
+	$path =~ s/\/\/+/\//g;
+	$path =~ s/^\.\///;
+	$path =~ s/\/$//;
+	return $path;
+}
+
+sub packageManifestBegin {
+	my( $dstDir ) = @_;
+	$packageDir = packagePath( $dstDir );
+	%packageManifest = ();
+	%packageTouched = ();
+	$packageCopied = 0;
+	$packageSkipped = 0;
+	if( ! -e $packageDir ) {
+		return;
+	}
+	my $m = -f "$packageDir.manifest" ? eval { retrieve( "$packageDir.manifest" ) } : 0;
+	if( ! $m || ref( $m ) ne 'HASH' || ref( $m->{files} ) ne 'HASH' ) {
+		packageAbort( "$packageDir exists but has no readable $packageDir.manifest, so it",
+			"may not be an earlier package.  Remove it yourself if it is." );
+	}
+	if( $m->{config} ne $configName ) {
+		# ANOTHER config's package; start over
+		recursiveUnlink( $packageDir );
+		if( -d $packageDir ) {
+			packageCantRemove( $packageDir );
+		}
+		return;
+	}
+	%packageManifest = %{$m->{files}};
+
+	# REMOVE everything the manifest doesn't account for
+	foreach my $dir( reverse recurseDir( $packageDir ) ) {
+		opendir DIR, $dir;
+		my @contents = map "$dir/$_", sort grep !/^\.\.?$/, readdir DIR;
+		closedir DIR;
+		foreach( @contents ) {
+			if( ( -f || -l ) && !$packageManifest{ packagePath( $_ ) } ) {
+				print "Removing unmanaged $_\n" if( $verbose );
+				unlink( $_ ) || packageCantRemove( $_ );
+			}
+		}
+		rmdir( $dir ) if( $dir ne $packageDir );
+			# only succeeds if it is now empty
+	}
+}
+
+sub packageAbort {
+	print "\n* PACKAGING ERROR: ", join( "\n  ", @_ ), "\n\n";
+	exit;
+}
+
+sub packageCantRemove {
+	my( $path ) = @_;
+	packageAbort( "$path could not be removed!",
+		"Ensure you aren't using this folder or its subfolders in any way, such",
+		"as viewing them in Explorer, or running a program that lives within." );
+}
+
+sub packageManifestEnd {
+	# REMOVE files that earlier packages copied but this one didn't.  Files the
+	# manifest doesn't know about (options.cfg etc.) are written fresh each time.
+	my $removed = 0;
+	foreach my $dst( sort keys %packageManifest ) {
+		if( !$packageTouched{$dst} ) {
+			print "Removing stale $dst\n" if( $verbose );
+			unlink( $dst );
+			delete $packageManifest{$dst};
+			$removed++;
+		}
+	}
+	print "Packaged: $packageCopied copied, $packageSkipped unchanged, $removed removed\n";
+	nstore( { config => $configName, files => \%packageManifest }, "$packageDir.manifest" );
+	$packageDir = '';
+}
+
+sub fileMd5 {
+	my( $file ) = @_;
+	open( my $fh, '<', $file ) or return '';
+	binmode( $fh );
+	my $md5 = Digest::MD5->new->addfile( $fh )->hexdigest;
+	close( $fh );
+	return $md5;
+}
+
+sub packageCp {
+	my( $src, $dst ) = @_;
+	$dst = packagePath( $dst );
+	my( $mode, $size, $mtime ) = (stat($src))[2,7,9];
+	my $entry = $packageManifest{$dst};
+	$packageTouched{$dst} = 1;
+
+	my $md5;
+	if( $entry && $entry->{srcSize} == $size && $entry->{srcMtime} == $mtime ) {
+		$md5 = $entry->{md5};
+	}
+	else {
+		$md5 = fileMd5( $src );
+	}
+
+	if( $entry && $entry->{md5} eq $md5 && -f $dst && (stat($dst))[9] == $entry->{dstMtime} ) {
+		# UNCHANGED, just note the source's new mtime if it was touched
+		$entry->{srcSize} = $size;
+		$entry->{srcMtime} = $mtime;
+		$packageSkipped++;
+		return;
+	}
+
+	print "Copy $src to $dst\n" if( $verbose );
+	unlink( $dst );
+		# in case it is read-only
+	copy( $src, $dst );
+	chmod( $mode, $dst );
+	$packageManifest{$dst} = { md5 => $md5, srcSize => $size, srcMtime => $mtime, dstMtime => (stat($dst))[9] };
+	$packageCopied++;
+}
+
+
+####################################################################################################
+#
+# S3 UPLOAD
+#
+# s3UploadResumable() uploads a package as a multipart upload whose parts are
+# sent by $s3Jobs forked workers.  Each part carries a Content-MD5 that S3
+# checks, and the parts S3 reports holding are verified against the local file
+# before the upload is completed.  The upload id is kept in <file>.s3upload
+# until the upload completes, so an interrupted upload resumes where it left
+# off when the release is run again.
+#
+# Configured from the environment:
+#   ZLAB_S3_BUCKET      destination bucket (enables this path)
+#   ZLAB_S3_PREFIX      key prefix, e.g. "builds/"
+#   ZLAB_S3_ENDPOINT    host[:port], defaults to s3.amazonaws.com.  Any other
+#                       endpoint (e.g. a local S3-compatible server for testing)
+#                       uses path-style bucket addressing.
+#   ZLAB_S3_SECURE      0 for http, defaults to https
+#   ZLAB_S3_ACCESS_KEY, ZLAB_S3_SECRET_KEY (or AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY)
+#   ZLAB_S3_PART_MB     part size, default 16
+#   ZLAB_S3_JOBS        parallel part uploads, default 8
+#
+####################################################################################################
+
+sub s3Bucket {
+	my $endpoint = $ENV{ZLAB_S3_ENDPOINT} ? $ENV{ZLAB_S3_ENDPOINT} : 's3.amazonaws.com';
+	my $s3 = Amazon::S3->new( {
+		aws_access_key_id => $ENV{ZLAB_S3_ACCESS_KEY} ? $ENV{ZLAB_S3_ACCESS_KEY} : $ENV{AWS_ACCESS_KEY_ID},
+		aws_secret_access_key => $ENV{ZLAB_S3_SECRET_KEY} ? $ENV{ZLAB_S3_SECRET_KEY} : $ENV{AWS_SECRET_ACCESS_KEY},
+		host => $endpoint,
+		secure => defined $ENV{ZLAB_S3_SECURE} ? $ENV{ZLAB_S3_SECURE} : 1,
+		dns_bucket_names => $endpoint =~ /amazonaws\.com$/ ? 1 : 0,
+		retry => 1,
+		timeout => 120,
+	} );
+	return $s3->bucket( $s3Bucket );
+}
+
+sub s3PartMd5s {
+	# MD5 (hex) of each $partSize piece of $file, indexed from part 1
+	my( $file, $partSize ) = @_;
+	my @md5s = ( '' );
+	open( my $fh, '<', $file ) or return ();
+	binmode( $fh );
+	my $data;
+	while( read( $fh, $data, $partSize ) ) {
+		push @md5s, Digest::MD5::md5_hex( $data );
+	}
+	close( $fh );
+	return @md5s;
+}
+
+sub s3UploadParts {
+	# CHILD: upload every part in @parts, retrying each a few times
+	my( $file, $key, $uploadId, $partSize, @parts ) = @_;
+	my $bucket = s3Bucket();
+	open( my $fh, '<', $file ) or return 0;
+	binmode( $fh );
+	foreach my $n( @parts ) {
+		my $data;
+		seek( $fh, ( $n - 1 ) * $partSize, 0 );
+		read( $fh, $data, $partSize );
+		my $etag;
+		for( my $try=0; $try<4 && !$etag; $try++ ) {
+			sleep( 1 << $try ) if( $try );
+			$etag = $bucket->upload_part( $key, $uploadId, $n, $data );
+		}
+		if( !$etag ) {
+			print "  part $n failed: " . $bucket->errstr . "\n";
+			close( $fh );
+			return 0;
+		}
+	}
+	close( $fh );
+	return 1;
+}
+
+sub s3UploadResumable {
+	my( $file ) = @_;
+	my $partSize = ( $ENV{ZLAB_S3_PART_MB} ? int( $ENV{ZLAB_S3_PART_MB} ) : 16 ) * 1024 * 1024;
+	my $jobs = $ENV{ZLAB_S3_JOBS} ? int( $ENV{ZLAB_S3_JOBS} ) : 8;
+	my $key = $ENV{ZLAB_S3_PREFIX} . fileparse( $file );
+	my( $size, $mtime ) = (stat($file))[7,9];
+	my $bucket = s3Bucket();
+
+	if( $size <= $partSize ) {
+		# SMALL files go up in one request, checked by its Content-MD5
+		open( my $fh, '<', $file ) or return 0;
+		binmode( $fh );
+		my $data = do { local $/; <$fh> };
+		close( $fh );
+		return $bucket->add_key( $key, $data, { 'Content-MD5' => Digest::MD5::md5_base64( $data ) . '==' } );
+	}
+
+	my @md5s = s3PartMd5s( $file, $partSize );
+	my $partCount = $#md5s;
+
+	# RESUME an earlier attempt at the same file if there was one
+	my $stateFile = "$file.s3upload";
+	my $state = -f $stateFile ? eval { retrieve( $stateFile ) } : undef;
+	my $uploadId;
+	my $done = {};
+	if( $state && $state->{key} eq $key && $state->{bucket} eq $s3Bucket && $state->{size} == $size && $state->{mtime} == $mtime && $state->{partSize} == $partSize ) {
+		$done = $bucket->list_parts( $key, $state->{uploadId} );
+		if( $done ) {
+			$uploadId = $state->{uploadId};
+			print "  resuming, " . scalar( keys %$done ) . " of $partCount parts already uploaded\n";
+		}
+		else {
+			$done = {};
+		}
+	}
+	if( !$uploadId ) {
+		$uploadId = $bucket->initiate_multipart_upload( $key );
+		if( !$uploadId ) {
+			print "  could not start upload: " . $bucket->errstr . "\n";
+			return 0;
+		}
+		nstore( { key=>$key, bucket=>$s3Bucket, size=>$size, mtime=>$mtime, partSize=>$partSize, uploadId=>$uploadId }, $stateFile );
+	}
+
+	# UPLOAD the missing parts in parallel, dealing them out round-robin
+	my @todo = grep { lc( $done->{$_} ) ne $md5s[$_] } ( 1 .. $partCount );
+	$jobs = 1 if( $jobs < 1 );
+	$jobs = scalar( @todo ) if( $jobs > scalar( @todo ) );
+	my @pids;
+	for( my $j=0; $j<$jobs; $j++ ) {
+		my @mine = @todo[ grep { $_ % $jobs == $j } ( 0 .. $#todo ) ];
+		my $pid = fork();
+		if( !defined $pid ) {
+			print "  fork failed: $!\n";
+			last;
+		}
+		if( $pid == 0 ) {
+			exit( s3UploadParts( $file, $key, $uploadId, $partSize, @mine ) ? 0 : 1 );
+		}
+		push @pids, $pid;
+	}
+	foreach( @pids ) {
+		waitpid( $_, 0 );
+	}
+
+	# VERIFY that S3 holds every part as we have it, then assemble
+	$done = $bucket->list_parts( $key, $uploadId );
+	if( !$done ) {
+		print "  could not list parts: " . $bucket->errstr . "\n";
+		return 0;
+	}
+	my @bad = grep { lc( $done->{$_} ) ne $md5s[$_] } ( 1 .. $partCount );
+	if( @bad ) {
+		print "  " . scalar( @bad ) . " parts missing or damaged\n";
+		return 0;
+	}
+	my $etag = $bucket->complete_multipart_upload( $key, $uploadId, $done );
+	my $expect = Digest::MD5::md5_hex( join( '', map { pack( 'H*', $md5s[$_] ) } ( 1 .. $partCount ) ) ) . "-$partCount";
+	if( lc( $etag ) ne $expect ) {
+		print "  upload completed with etag $etag, expected $expect\n";
+		return 0;
+	}
+	unlink( $stateFile );
+	return 1;
+}
+
+
 ####################################################################################################
 #
 # UTILITY
@@ -1723,6 +2422,22 @@ sub platformBuild64Bit {
 	return $build64bit;
 }
 
+sub numProcessors {
+	# The number of cores on this machine, used as the default parallel job count
+	my $n;
+	if( $platform eq 'win32' ) {
+		$n = $ENV{NUMBER_OF_PROCESSORS};
+	}
+	elsif( $platform eq 'macosx' ) {
+		$n = `sysctl -n hw.ncpu 2> /dev/null`;
+	}
+	else {
+		$n = `getconf _NPROCESSORS_ONLN 2> /dev/null`;
+	}
+	chomp $n;
+	return $n > 0 ? int( $n ) : 1;
+}
+
 sub platformDescription {
 	my $s;
 
@@ -1949,6 +2664,8 @@ sub executeCmd {
 	my( $cmd ) = @_;
 	my( $dieOnError ) = @_;
 	my $cwd = getcwd();
+	my $stderrFile = "__stderr__$$";
+		# unique per process so that forked workers don't share it
 	if( $verbose ) {
 		print "Executing (in $cwd): '$cmd'\n";
 		print "ENV{path} is: $ENV{path}\n";
@@ -1962,13 +2679,13 @@ sub executeCmd {
 	my $oldLDFLAGS = $ENV{LDFLAGS};
 	$ENV{CPPFLAGS}='';
 	$ENV{LDFLAGS}='';	
-	my $result = `$cmd 2> __stderr__`;
+	my $result = `$cmd 2> $stderrFile`;
 	$ENV{CPPFLAGS}=$oldCPPFLAGS;
 	$ENV{LDFLAGS}=$oldLDFLAGS;
 	if( $? == 0 && $verbose ) {
 		print "STDOUT :\n$result\n\n";
 		print "STDERR :\n";
-		open( FILE, "__stderr__" );
+		open( FILE, $stderrFile );
 		while( <FILE> ) { print; }
 		close( FILE );
 	}
@@ -1979,17 +2696,17 @@ sub executeCmd {
 		print "--------------------- TRACE FROM TOOL -------------------\n";
 		print $result;
 		print "stderr:\n";
-		open( FILE, "__stderr__" );
+		open( FILE, $stderrFile );
 		while( <FILE> ) { print; }
 		close( FILE );
 		print "-------------------- END TRACE FROM TOOL ----------------\n\n";
-		unlink( "__stderr__" );
+		unlink( $stderrFile );
 		if( $dieOnError ) {
 			die;
 		}
 		return 0;
 	}
-	unlink( "__stderr__" );
+	unlink( $stderrFile );
 	return 1;
 }
 
@@ -2077,6 +2794,10 @@ sub cp {
 		$dst .= "/$1";
 	}
 	if( -f $src ) {
+		if( $packageDir && index( packagePath( $dst ), "$packageDir/" ) == 0 ) {
+			packageCp( $src, $dst );
+			return;
+		}
 		my $mode = (stat($src))[2];
 		my $dateSrc = (stat($src))[9];
 		my $dateDst = (stat($dst))[9];
@@ -2126,6 +2847,18 @@ sub cpRecurse {
 	}
 }
 
+sub findExecutable {
+	# The path of program $name if it is on the PATH, otherwise ''
+	my( $name ) = @_;
+	my $sep = $platform eq 'win32' ? ';' : ':';
+	foreach my $dir( split( $sep, $ENV{PATH} ) ) {
+		foreach my $f( "$dir/$name", "$dir/$name.exe" ) {
+			return $f if( -f $f && -x $f );
+		}
+	}
+	return '';
+}
+
 sub readAllLines {
 	my( $filename ) = @_;
 	my @lines;
@@ -2138,6 +2871,19 @@ sub readAllLines {
 	return @lines;
 }
 
+sub replaceFileIfChanged {
+	# Moves $new over $old unless they are identical, in which case $new is
+	# discarded and $old keeps its timestamp.
+	my( $new, $old ) = @_;
+	if( -f $old && compare( $new, $old ) == 0 ) {
+		unlink( $new );
+		return 0;
+	}
+	unlink( $old );
+	move( $new, $old );
+	return 1;
+}
+
 sub uniquify {
 	my @list = @_;
 	my %uniq;
@@ -2838,7 +3584,7 @@ sub win32_createMakefile_VC90 {
 					/>
 					<Tool
 						Name="VCCLCompilerTool"
-						AdditionalOptions="/wd4996 /wd4786 "
+						AdditionalOptions="/wd4996 /wd4786 /MP$buildJobs $hash{win32releaseflags} "
 						Optimization="2"
 						InlineFunctionExpansion="1"
 						AdditionalIncludeDirectories="$includes"
@@ -2868,6 +3614,7 @@ sub win32_createMakefile_VC90 {
 					/>
 					<Tool
 						Name="VCLinkerTool"
+						AdditionalOptions="$hash{win32releaselinkflags}"
 						AdditionalDependencies="$relLibs"
 						OutputFile=".\\Release\\$name.exe"
 						LinkIncremental="2"
@@ -3227,8 +3974,10 @@ sub win32_createMakefile_VC120 {
       <HeaderFileName />
     </Midl>
     <ClCompile>
-      <AdditionalOptions>/wd4996 /wd4786  %(AdditionalOptions)</AdditionalOptions>
+      <AdditionalOptions>/wd4996 /wd4786 $hash{win32releaseflags} %(AdditionalOptions)</AdditionalOptions>
       <Optimization>MaxSpeed</Optimization>
+      <MultiProcessorCompilation>true</MultiProcessorCompilation>
+      <ProcessorNumber>$buildJobs</ProcessorNumber>
       <InlineFunctionExpansion>OnlyExplicitInline</InlineFunctionExpansion>
       <AdditionalIncludeDirectories>$includes%(AdditionalIncludeDirectories)</AdditionalIncludeDirectories>
       <PreprocessorDefinitions>POINTER_64=__ptr64;_CRT_SECURE_NO_WARNINGS=1;NDEBUG;WIN32;_WINDOWS;$relDefines$console;%(PreprocessorDefinitions)</PreprocessorDefinitions>
@@ -3249,6 +3998,7 @@ sub win32_createMakefile_VC120 {
       <Culture>0x0409</Culture>
     </ResourceCompile>
     <Link>
+      <AdditionalOptions>$hash{win32releaselinkflags} %(AdditionalOptions)</AdditionalOptions>
       <AdditionalDependencies>$relLibs%(AdditionalDependencies)</AdditionalDependencies>
       <OutputFile>.\\Release\\zlab.exe</OutputFile>
       <SuppressStartupBanner>true</SuppressStartupBanner>
@@ -3275,8 +4025,10 @@ sub win32_createMakefile_VC120 {
       </HeaderFileName>
     </Midl>
     <ClCompile>
-      <AdditionalOptions>/wd4996 /wd4786  %(AdditionalOptions)</AdditionalOptions>
+      <AdditionalOptions>/wd4996 /wd4786 $hash{win32releaseflags} %(AdditionalOptions)</AdditionalOptions>
       <Optimization>MaxSpeed</Optimization>
+      <MultiProcessorCompilation>true</MultiProcessorCompilation>
+      <ProcessorNumber>$buildJobs</ProcessorNumber>
       <InlineFunctionExpansion>OnlyExplicitInline</InlineFunctionExpansion>
       <AdditionalIncludeDirectories>$includes%(AdditionalIncludeDirectories)</AdditionalIncludeDirectories>
       <PreprocessorDefinitions>POINTER_64=__ptr64;_CRT_SECURE_NO_WARNINGS=1;NDEBUG;WIN32;_WINDOWS;$relDefines$console;%(PreprocessorDefinitions)</PreprocessorDefinitions>
@@ -3297,6 +4049,7 @@ sub win32_createMakefile_VC120 {
       <Culture>0x0409</Culture>
     </ResourceCompile>
     <Link>
+      <AdditionalOptions>$hash{win32releaselinkflags} %(AdditionalOptions)</AdditionalOptions>
       <AdditionalDependencies>$relLibs%(AdditionalDependencies)</AdditionalDependencies>
       <OutputFile>.\\Release\\zlab.exe</OutputFile>
       <SuppressStartupBanner>true</SuppressStartupBanner>
@@ -3414,7 +4167,9 @@ ENDOFVCPROJFILTERS
 sub linux_createMakefile {
 	my %hash = @_;
 
-	open( MAKEFILE, ">Makefile" );
+	open( MAKEFILE, ">Makefile.new" );
+		# written to a temp file first so that the Makefile is only touched when
+		# its content changes; all objects depend on it (see OBJS rule below)
 	print MAKEFILE "PROGRAM = zlab\n";
 	print MAKEFILE "\n";
 	print MAKEFILE "INCLUDES = \\\n";
@@ -3424,6 +4179,8 @@ sub linux_createMakefile {
 	print MAKEFILE "\t-lpthread \\\n";
 		# always link to pthread even if not explicit depends; new linux distros I've tried seem to
 		# want pthread from the x11 stuff we link to? (tfb)
+	print MAKEFILE "\t-ldl -Wl,--export-dynamic \\\n";
+		# dladdr() and an exported symbol table let zlabsampler name functions
 	map{ $_ =~ tr#\\#/#; print MAKEFILE "\t$_ \\\n" } uniquify( @{$hash{linuxlibs}} );
 	print MAKEFILE "\n";
 	print MAKEFILE "SRC_FILES = \\\n";
@@ -3442,10 +4199,12 @@ sub linux_createMakefile {
 	print MAKEFILE "OBJS1 = \$(SRC_FILES)\n";
 	print MAKEFILE "OBJS2 = \$(subst .cpp,.o,\$(OBJS1))\n";
 	print MAKEFILE "OBJS = \$(subst .c,.o,\$(OBJS2))\n";
+	print MAKEFILE "DEPS = \$(OBJS:.o=.d)\n";
 	print MAKEFILE "\n";
 	print MAKEFILE "CC = g++\n";
 	print MAKEFILE "\n";
-	print MAKEFILE "CFLAGS = -g -O3 \$(INCLUDES)  -Wno-write-strings\n";
+	print MAKEFILE "CFLAGS = -g -O3 $hash{gccflags} \$(INCLUDES)  -Wno-write-strings\n";
+	print MAKEFILE "LDFLAGS = $hash{gcclinkflags}\n";
 	print MAKEFILE "\n";
 	print MAKEFILE "#####################################################################################################\n";
 	print MAKEFILE "\n";
@@ -3453,7 +4212,7 @@ sub linux_createMakefile {
 	print MAKEFILE "\n";
 	print MAKEFILE "\%.o : \%.cpp\n";
 	print MAKEFILE "\t\@echo \$<\n";
-	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) \$(DEFINES) -fpermissive -Wno-non-template-friend -c \$< -o \$@\n";
+	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) \$(DEFINES) -fpermissive -Wno-non-template-friend -MMD -MP -c \$< -o \$@\n";
 	print MAKEFILE "\n";
 	my $wroteCMessage = 0;
 	foreach ( sort uniquify( @{$hash{files}} ) ) {
@@ -3466,25 +4225,30 @@ sub linux_createMakefile {
 			$o =~ s/\.c$/\.o/;
 			print MAKEFILE "$o : $_\n";
 			print MAKEFILE "\t\@echo \$<\n";
-			print MAKEFILE "\t\@gcc \$(CFLAGS) -c \$< -o \$\@\n";
+			print MAKEFILE "\t\@gcc \$(CFLAGS) -MMD -MP -c \$< -o \$\@\n";
 			print MAKEFILE "\n";
 		}
 	}
 	print MAKEFILE "\$(PROGRAM): \$(OBJS)\n";
-	print MAKEFILE "\t\@libtool --mode=link \$(CC) \$(CFLAGS) \$^ -o \$\@ \$(LIB_DIRS) \$(LIBS)\n";
+	print MAKEFILE "\t\@libtool --mode=link \$(CC) \$(CFLAGS) \$(LDFLAGS) \$^ -o \$\@ \$(LIB_DIRS) \$(LIBS)\n";
 	print MAKEFILE "\t\@echo ==============================================\n";
 	print MAKEFILE "\t\@echo ================= SUCCESS ====================\n";
 	print MAKEFILE "\t\@echo ============= To run: ./zlab =================\n";
 	print MAKEFILE "\t\@echo ==============================================\n";
 	print MAKEFILE "\n";
-	print MAKEFILE "clean: #depend\n";
+	print MAKEFILE "### changes to flags, defines or the file list rebuild everything\n";
+	print MAKEFILE "\$(OBJS): Makefile\n";
+	print MAKEFILE "\n";
+	print MAKEFILE "clean:\n";
 	print MAKEFILE "\trm -f \$(OBJS)\n";
+	print MAKEFILE "\trm -f \$(DEPS)\n";
 	print MAKEFILE "\trm -f \$(PROGRAM)\n";
 	print MAKEFILE "\n";
-	print MAKEFILE "#depend:\n";
-	print MAKEFILE "#\tmakedepend \$(CFLAGS) \$(DEFINES) \$(SRC_CORE) \$(SRC_PLUGINS) \$(SRC_ZBSLIB)\n";
+	print MAKEFILE "### header dependencies written by -MMD on the previous build\n";
+	print MAKEFILE "-include \$(DEPS)\n";
 
 	close( MAKEFILE );
+	replaceFileIfChanged( "Makefile.new", "Makefile" );
 }
 
 sub macosx_createMakefile {
@@ -3502,7 +4266,8 @@ sub macosx_createMakefile {
 	$files =~ s/filedialog_native.cpp/filedialog_native.mm/g;
 	@{$hash{files}} = split( /:/, $files );
 
-	open( MAKEFILE, ">Makefile" );
+	open( MAKEFILE, ">Makefile.new" );
+		# see linux_createMakefile
 	print MAKEFILE "PROGRAM = $hash{name}App\n";
 	print MAKEFILE "\n";
 	print MAKEFILE "INCLUDES = \\\n";
@@ -3531,10 +4296,12 @@ sub macosx_createMakefile {
 	print MAKEFILE "OBJS2 = \$(subst .cpp,.o,\$(OBJS1))\n";
 	print MAKEFILE "OBJS3 = \$(subst .mm,.o,\$(OBJS2))\n";
 	print MAKEFILE "OBJS = \$(subst .c,.o,\$(OBJS3))\n";
+	print MAKEFILE "DEPS = \$(OBJS:.o=.d)\n";
 	print MAKEFILE "\n";
 	print MAKEFILE "CC = $compiler\n";
 	print MAKEFILE "\n";
-	print MAKEFILE "CFLAGS = -g $optimize -fwritable-strings -Wno-write-strings -mmacosx-version-min=$minVersion \$(INCLUDES) \$(DEFINES)\n";
+	print MAKEFILE "CFLAGS = -g $optimize $hash{gccflags} -fwritable-strings -Wno-write-strings -mmacosx-version-min=$minVersion \$(INCLUDES) \$(DEFINES)\n";
+	print MAKEFILE "LDFLAGS = $hash{gcclinkflags}\n";
 	print MAKEFILE "\n";
 	print MAKEFILE "#####################################################################################################\n";
 	print MAKEFILE "\n";
@@ -3542,11 +4309,11 @@ sub macosx_createMakefile {
 	print MAKEFILE "\n";
 	print MAKEFILE "\%.o : \%.mm\n";
 	print MAKEFILE "\t\@echo \$<\n";
-	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) -c \$< -o \$@\n";
+	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) -MMD -MP -c \$< -o \$@\n";
 	print MAKEFILE "\n";
 	print MAKEFILE "\%.o : \%.cpp\n";
 	print MAKEFILE "\t\@echo \$<\n";
-	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) -fpermissive -c \$< -o \$@\n";
+	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) -fpermissive -MMD -MP -c \$< -o \$@\n";
 	print MAKEFILE "\n";
 	my $wroteCMessage = 0;
 	foreach ( sort uniquify( @{$hash{files}} ) ) {
@@ -3559,12 +4326,12 @@ sub macosx_createMakefile {
 			$o =~ s/\.c$/\.o/;
 			print MAKEFILE "$o : $_\n";
 			print MAKEFILE "\t\@echo \$<\n";
-			print MAKEFILE "\t\@gcc \$(CFLAGS) -fpermissive -Wno-non-template-friend -c \$< -o \$\@\n";
+			print MAKEFILE "\t\@gcc \$(CFLAGS) -fpermissive -Wno-non-template-friend -MMD -MP -c \$< -o \$\@\n";
 			print MAKEFILE "\n";
 		}
 	}
 	print MAKEFILE "\$(PROGRAM): \$(OBJS)\n";
-	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) \$^ \$(LIBS) -framework AGL -framework OpenGL -framework $windowLib -framework IOKit -framework CoreFoundation -framework CoreAudio -framework AudioUnit -framework AudioToolbox -framework CoreMIDI -o \$(PROGRAM)\n";
+	print MAKEFILE "\t\@\$(CC) \$(CFLAGS) \$(LDFLAGS) \$^ \$(LIBS) -framework AGL -framework OpenGL -framework $windowLib -framework IOKit -framework CoreFoundation -framework CoreAudio -framework AudioUnit -framework AudioToolbox -framework CoreMIDI -o \$(PROGRAM)\n";
 		#IOKit and CoreFoundation frameworks were added to support static linking to the Secutech usbkey library.
 	print MAKEFILE "\t\@mkdir -p zlab.app/Contents/Resources\n";
 	print MAKEFILE "\t\@mkdir -p zlab.app/Contents/MacOS\n";
@@ -3607,16 +4374,21 @@ sub macosx_createMakefile {
 	print MAKEFILE "\t\@echo ============= To run: open zlab.app ==========\n";
 	print MAKEFILE "\t\@echo ==============================================\n";		
 	print MAKEFILE "\n";
-	print MAKEFILE "clean: #depend\n";
+	print MAKEFILE "### changes to flags, defines or the file list rebuild everything\n";
+	print MAKEFILE "\$(OBJS): Makefile\n";
+	print MAKEFILE "\n";
+	print MAKEFILE "clean:\n";
 	print MAKEFILE "\trm -f \$(OBJS)\n";
+	print MAKEFILE "\trm -f \$(DEPS)\n";
 	print MAKEFILE "\trm -f \$(PROGRAM)\n";
 	print MAKEFILE "\trm -rf zlab.app\n";
 	print MAKEFILE "\trm -rf $hash{name}\n";
 	print MAKEFILE "\n";
-	print MAKEFILE "#depend:\n";
-	print MAKEFILE "#\tmakedepend \$(CFLAGS) \$(SRC_CORE) \$(SRC_PLUGINS) \$(SRC_ZBSLIB)\n";
+	print MAKEFILE "### header dependencies written by -MMD on the previous build\n";
+	print MAKEFILE "-include \$(DEPS)\n";
 
 	close( MAKEFILE );
+	replaceFileIfChanged( "Makefile.new", "Makefile" );
 	
 	# Create an xcode projectfile as well...
 	#
@@ -4198,12 +4970,14 @@ ENDCFG
 
 sub linux_runMakefile {
 	my %hash = @_;
-	executeCmd( "make -f $hash{linuxname} $hash{target}" );
+	my $keepGoing = $hash{keepgoing} ? "-k" : "";
+	executeCmd( "make -j$buildJobs $keepGoing -f $hash{linuxname} $hash{target}" );
 }
 
 sub macosx_runMakefile {
 	my %hash = @_;
-	executeCmd( "make -f $hash{macosxname} $hash{target}" );
+	my $keepGoing = $hash{keepgoing} ? "-k" : "";
+	executeCmd( "make -j$buildJobs $keepGoing -f $hash{macosxname} $hash{target}" );
 }
 
 sub win32_runMakefile {
@@ -4215,7 +4989,7 @@ sub win32_runMakefile {
 		my $projname = platformBuild64Bit() ? $hash{win64name} : $hash{win64name};
 			# um, vs2013 was originally used to just build win64, but even if we're building
 			# a 32bit version, the name of the projectfile is the vcxproj format... 
-		executeCmd( "msbuild $projname $clean /p:Platform=$platform /p:Configuration=\"$hash{win32config}\"" );
+		executeCmd( "msbuild $projname $clean /m:$buildJobs /p:Platform=$platform /p:Configuration=\"$hash{win32config}\"" );
 	}
 	else {
 		my $clean = $hash{target} eq 'clean' ? "/clean" : "";
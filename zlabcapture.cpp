@@ -0,0 +1,575 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Frame capture to PNG sequence or raw video through a ring of pixel buffer objects
+//		}
+//		*REQUIRED_FILES zlabcapture.cpp zlabcapture.h
+//		*SDK_DEPENDS glfw-2.7.2
+// }
+
+// OPERATING SYSTEM specific includes:
+#ifdef WIN32
+#include "windows.h"
+#endif
+// SDK includes:
+#ifdef __APPLE__
+#include "OpenGL/gl.h"
+#else
+#include "GL/gl.h"
+#endif
+#include "GL/glfw.h"
+#ifdef ZMSG_MULTITHREAD
+// @ZBSIF extraDefines( 'ZMSG_MULTITHREAD' )
+	#include "pthread.h"
+// @ZBSENDIF
+#endif
+// STDLIB includes:
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "assert.h"
+// MODULE includes:
+#include "zlabcapture.h"
+#include "mainutil.h"
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER_ARB
+#define GL_PIXEL_PACK_BUFFER_ARB 0x88EB
+#endif
+#ifndef GL_STREAM_READ_ARB
+#define GL_STREAM_READ_ARB 0x88E1
+#endif
+#ifndef GL_READ_ONLY_ARB
+#define GL_READ_ONLY_ARB 0x88B8
+#endif
+
+typedef void (APIENTRY *CaptureGenBuffersFn)( GLsizei n, GLuint *buffers );
+typedef void (APIENTRY *CaptureDeleteBuffersFn)( GLsizei n, const GLuint *buffers );
+typedef void (APIENTRY *CaptureBindBufferFn)( GLenum target, GLuint buffer );
+typedef void (APIENTRY *CaptureBufferDataFn)( GLenum target, ptrdiff_t size, const GLvoid *data, GLenum usage );
+typedef GLvoid *(APIENTRY *CaptureMapBufferFn)( GLenum target, GLenum access );
+typedef GLboolean (APIENTRY *CaptureUnmapBufferFn)( GLenum target );
+
+static CaptureGenBuffersFn captureGenBuffers = 0;
+static CaptureDeleteBuffersFn captureDeleteBuffers = 0;
+static CaptureBindBufferFn captureBindBuffer = 0;
+static CaptureBufferDataFn captureBufferData = 0;
+static CaptureMapBufferFn captureMapBuffer = 0;
+static CaptureUnmapBufferFn captureUnmapBuffer = 0;
+static int capturePBOChecked = 0;
+static int capturePBOSupported = 0;
+
+static int captureCheckPBO() {
+	if( !capturePBOChecked ) {
+		capturePBOChecked = 1;
+		if( glfwExtensionSupported( "GL_ARB_pixel_buffer_object" ) ) {
+			captureGenBuffers = (CaptureGenBuffersFn)glfwGetProcAddress( "glGenBuffersARB" );
+			captureDeleteBuffers = (CaptureDeleteBuffersFn)glfwGetProcAddress( "glDeleteBuffersARB" );
+			captureBindBuffer = (CaptureBindBufferFn)glfwGetProcAddress( "glBindBufferARB" );
+			captureBufferData = (CaptureBufferDataFn)glfwGetProcAddress( "glBufferDataARB" );
+			captureMapBuffer = (CaptureMapBufferFn)glfwGetProcAddress( "glMapBufferARB" );
+			captureUnmapBuffer = (CaptureUnmapBufferFn)glfwGetProcAddress( "glUnmapBufferARB" );
+			capturePBOSupported =
+				captureGenBuffers && captureDeleteBuffers && captureBindBuffer &&
+				captureBufferData && captureMapBuffer && captureUnmapBuffer
+			;
+		}
+		trace( "zlabcapture: %s\n", capturePBOSupported ? "using pixel buffer objects" : "no pixel buffer objects, using glReadPixels" );
+	}
+	return capturePBOSupported;
+}
+
+// Frames handed to the encoder
+//===============================================================================
+
+struct CaptureFrame {
+	int w, h;
+	unsigned char *rgba;
+		// bottom row first, as read from GL
+	int alloc;
+};
+
+static const int ENCODE_QUEUE_SIZE = 8;
+static CaptureFrame encodeQueue[ENCODE_QUEUE_SIZE];
+static int encodeHead = 0, encodeCount = 0;
+	// ring of frames waiting for the encoder
+static CaptureFrame freeFrames[ENCODE_QUEUE_SIZE+1];
+static int freeFrameCount = 0;
+	// buffers the encoder has finished with, for reuse
+
+static char captureDir[512];
+static int captureFormat = ZLAB_CAPTURE_PNG;
+static int captureActive = 0;
+static volatile int framesWritten = 0;
+static int framesDropped = 0;
+static FILE *rawFile = 0;
+static int rawW = 0, rawH = 0;
+	// a raw video has one frame size, that of its first frame
+
+#ifdef ZMSG_MULTITHREAD
+static pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t captureCond = PTHREAD_COND_INITIALIZER;
+static pthread_t encoderThread;
+static int encoderRunning = 0;
+static int encoderQuit = 0;
+#define CAPTURE_LOCK() pthread_mutex_lock( &captureMutex )
+#define CAPTURE_UNLOCK() pthread_mutex_unlock( &captureMutex )
+#else
+#define CAPTURE_LOCK()
+#define CAPTURE_UNLOCK()
+#endif
+
+// PNG writing
+//===============================================================================
+// Written with stored (uncompressed) deflate blocks so that no compression
+// library is needed and the encoder stays cheap; the files are larger than
+// a compressed PNG but any tool can recompress them afterwards.
+
+static unsigned int crcTable[256];
+static int crcTableMade = 0;
+
+static void crcMakeTable() {
+	for( unsigned int n=0; n<256; n++ ) {
+		unsigned int c = n;
+		for( int k=0; k<8; k++ ) {
+			c = ( c & 1 ) ? 0xEDB88320u ^ ( c >> 1 ) : c >> 1;
+		}
+		crcTable[n] = c;
+	}
+	crcTableMade = 1;
+}
+
+static unsigned int crcUpdate( unsigned int crc, unsigned char *buf, int len ) {
+	for( int i=0; i<len; i++ ) {
+		crc = crcTable[ ( crc ^ buf[i] ) & 0xFF ] ^ ( crc >> 8 );
+	}
+	return crc;
+}
+
+static void pngPut32( unsigned char *p, unsigned int v ) {
+	p[0] = (unsigned char)( v >> 24 );
+	p[1] = (unsigned char)( v >> 16 );
+	p[2] = (unsigned char)( v >> 8 );
+	p[3] = (unsigned char)v;
+}
+
+struct PngChunkWriter {
+	FILE *f;
+	unsigned int crc;
+
+	void begin( char *type, unsigned int len ) {
+		unsigned char hdr[8];
+		pngPut32( hdr, len );
+		memcpy( hdr+4, type, 4 );
+		fwrite( hdr, 1, 8, f );
+		crc = crcUpdate( 0xFFFFFFFFu, hdr+4, 4 );
+	}
+	void data( unsigned char *buf, int len ) {
+		fwrite( buf, 1, len, f );
+		crc = crcUpdate( crc, buf, len );
+	}
+	void end() {
+		unsigned char c[4];
+		pngPut32( c, crc ^ 0xFFFFFFFFu );
+		fwrite( c, 1, 4, f );
+	}
+};
+
+static int pngWrite( char *path, CaptureFrame &frame, unsigned char *rowBuf ) {
+	FILE *f = fopen( path, "wb" );
+	if( !f ) {
+		return 0;
+	}
+	if( !crcTableMade ) {
+		crcMakeTable();
+	}
+
+	int w = frame.w, h = frame.h;
+	int rowBytes = 1 + w * 3;
+		// filter byte + RGB
+	unsigned int rawBytes = rowBytes * h;
+	unsigned int blocks = ( rawBytes + 65534 ) / 65535;
+	unsigned int zlen = 2 + rawBytes + blocks * 5 + 4;
+
+	static unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	fwrite( signature, 1, 8, f );
+
+	PngChunkWriter chunk;
+	chunk.f = f;
+
+	unsigned char ihdr[13];
+	pngPut32( ihdr, w );
+	pngPut32( ihdr+4, h );
+	ihdr[8] = 8;	// bit depth
+	ihdr[9] = 2;	// RGB
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	chunk.begin( "IHDR", 13 );
+	chunk.data( ihdr, 13 );
+	chunk.end();
+
+	chunk.begin( "IDAT", zlen );
+	unsigned char zhdr[2] = { 0x78, 0x01 };
+	chunk.data( zhdr, 2 );
+
+	unsigned int adlerA = 1, adlerB = 0;
+	unsigned int blockLeft = 0;
+	unsigned int remaining = rawBytes;
+	for( int y=0; y<h; y++ ) {
+		// FLIP to top row first and drop alpha
+		unsigned char *src = frame.rgba + ( h - 1 - y ) * w * 4;
+		rowBuf[0] = 0;
+		for( int x=0; x<w; x++ ) {
+			rowBuf[1+x*3+0] = src[x*4+0];
+			rowBuf[1+x*3+1] = src[x*4+1];
+			rowBuf[1+x*3+2] = src[x*4+2];
+		}
+		for( int i=0; i<rowBytes; i++ ) {
+			adlerA = ( adlerA + rowBuf[i] ) % 65521;
+			adlerB = ( adlerB + adlerA ) % 65521;
+		}
+
+		// EMIT the row, splitting it across stored blocks as needed
+		unsigned char *p = rowBuf;
+		int left = rowBytes;
+		while( left > 0 ) {
+			if( blockLeft == 0 ) {
+				blockLeft = remaining < 65535 ? remaining : 65535;
+				unsigned char bhdr[5];
+				bhdr[0] = remaining == blockLeft ? 1 : 0;
+					// BFINAL on the last block
+				bhdr[1] = (unsigned char)( blockLeft & 0xFF );
+				bhdr[2] = (unsigned char)( blockLeft >> 8 );
+				bhdr[3] = (unsigned char)( ~blockLeft & 0xFF );
+				bhdr[4] = (unsigned char)( ( ~blockLeft >> 8 ) & 0xFF );
+				chunk.data( bhdr, 5 );
+			}
+			int n = left < (int)blockLeft ? left : (int)blockLeft;
+			chunk.data( p, n );
+			p += n;
+			left -= n;
+			blockLeft -= n;
+			remaining -= n;
+		}
+	}
+	unsigned char adler[4];
+	pngPut32( adler, ( adlerB << 16 ) | adlerA );
+	chunk.data( adler, 4 );
+	chunk.end();
+
+	chunk.begin( "IEND", 0 );
+	chunk.end();
+
+	int ok = !ferror( f );
+	fclose( f );
+	return ok;
+}
+
+// Encoder
+//===============================================================================
+
+static void encodeFrame( CaptureFrame &frame, int index ) {
+	static unsigned char *rowBuf = 0;
+	static int rowBufAlloc = 0;
+	int need = 1 + frame.w * 4;
+	if( need > rowBufAlloc ) {
+		rowBuf = (unsigned char *)realloc( rowBuf, need );
+		rowBufAlloc = need;
+	}
+
+	if( captureFormat == ZLAB_CAPTURE_PNG ) {
+		char path[600];
+		sprintf( path, "%s/frame_%06d.png", captureDir, index );
+		if( !pngWrite( path, frame, rowBuf ) ) {
+			trace( "zlabcapture: unable to write %s\n", path );
+		}
+	}
+	else if( rawFile ) {
+		for( int y=frame.h-1; y>=0; y-- ) {
+			unsigned char *src = frame.rgba + y * frame.w * 4;
+			for( int x=0; x<frame.w; x++ ) {
+				rowBuf[x*3+0] = src[x*4+0];
+				rowBuf[x*3+1] = src[x*4+1];
+				rowBuf[x*3+2] = src[x*4+2];
+			}
+			fwrite( rowBuf, 1, frame.w * 3, rawFile );
+		}
+	}
+}
+
+static void frameRecycle( CaptureFrame &frame ) {
+	// Caller holds the lock
+	if( freeFrameCount < ENCODE_QUEUE_SIZE+1 ) {
+		freeFrames[freeFrameCount++] = frame;
+	}
+	else {
+		free( frame.rgba );
+	}
+}
+
+static int encodeNext() {
+	// Encode one queued frame; returns 0 if there was none.  Caller holds the lock.
+	if( encodeCount == 0 ) {
+		return 0;
+	}
+	CaptureFrame frame = encodeQueue[encodeHead];
+	encodeHead = ( encodeHead + 1 ) % ENCODE_QUEUE_SIZE;
+	encodeCount--;
+	int index = framesWritten;
+
+	CAPTURE_UNLOCK();
+	encodeFrame( frame, index );
+	CAPTURE_LOCK();
+
+	framesWritten++;
+	frameRecycle( frame );
+	return 1;
+}
+
+#ifdef ZMSG_MULTITHREAD
+static void *encoderThreadMain( void * ) {
+	CAPTURE_LOCK();
+	while( 1 ) {
+		if( !encodeNext() ) {
+			if( encoderQuit ) {
+				break;
+			}
+			pthread_cond_wait( &captureCond, &captureMutex );
+		}
+	}
+	CAPTURE_UNLOCK();
+	return 0;
+}
+#endif
+
+static void frameSubmit( int w, int h, void *pixels ) {
+	// COPY the pixels into a free frame buffer and queue it, dropping it if
+	// the encoder is too far behind
+	if( captureFormat == ZLAB_CAPTURE_RAW ) {
+		if( !rawW ) {
+			rawW = w;
+			rawH = h;
+		}
+		else if( w != rawW || h != rawH ) {
+			framesDropped++;
+			return;
+		}
+	}
+
+	CAPTURE_LOCK();
+	if( encodeCount == ENCODE_QUEUE_SIZE ) {
+		framesDropped++;
+		CAPTURE_UNLOCK();
+		return;
+	}
+	CaptureFrame frame;
+	memset( &frame, 0, sizeof(frame) );
+	if( freeFrameCount > 0 ) {
+		frame = freeFrames[--freeFrameCount];
+	}
+	CAPTURE_UNLOCK();
+
+	int bytes = w * h * 4;
+	if( frame.alloc < bytes ) {
+		free( frame.rgba );
+		frame.rgba = (unsigned char *)malloc( bytes );
+		frame.alloc = bytes;
+	}
+	frame.w = w;
+	frame.h = h;
+	memcpy( frame.rgba, pixels, bytes );
+
+	CAPTURE_LOCK();
+	encodeQueue[ ( encodeHead + encodeCount ) % ENCODE_QUEUE_SIZE ] = frame;
+	encodeCount++;
+	#ifdef ZMSG_MULTITHREAD
+		if( encoderRunning ) {
+			pthread_cond_signal( &captureCond );
+		}
+		else {
+			encodeNext();
+		}
+	#else
+		encodeNext();
+	#endif
+	CAPTURE_UNLOCK();
+}
+
+// Readback ring
+//===============================================================================
+
+static const int PBO_RING_SIZE = 3;
+	// frames are collected PBO_RING_SIZE-1 frames after their read is issued
+static GLuint pbos[PBO_RING_SIZE];
+static int pboW[PBO_RING_SIZE], pboH[PBO_RING_SIZE];
+static int pboPending[PBO_RING_SIZE];
+static int pboNext = 0;
+static int pboAllocW = 0, pboAllocH = 0;
+static unsigned char *syncPixels = 0;
+static int syncPixelsAlloc = 0;
+
+static void pboCollect( int i ) {
+	if( !pboPending[i] ) {
+		return;
+	}
+	pboPending[i] = 0;
+	(*captureBindBuffer)( GL_PIXEL_PACK_BUFFER_ARB, pbos[i] );
+	void *p = (*captureMapBuffer)( GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB );
+	if( p ) {
+		frameSubmit( pboW[i], pboH[i], p );
+		(*captureUnmapBuffer)( GL_PIXEL_PACK_BUFFER_ARB );
+	}
+	(*captureBindBuffer)( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+}
+
+static void pboFree() {
+	if( pboAllocW ) {
+		(*captureDeleteBuffers)( PBO_RING_SIZE, pbos );
+	}
+	memset( pboPending, 0, sizeof(pboPending) );
+	pboAllocW = pboAllocH = 0;
+	pboNext = 0;
+}
+
+void zlabCaptureFrame( int w, int h ) {
+	if( !captureActive || w <= 0 || h <= 0 ) {
+		return;
+	}
+
+	glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+	glReadBuffer( GL_BACK );
+
+	if( !captureCheckPBO() ) {
+		// SYNCHRONOUS fallback
+		int bytes = w * h * 4;
+		if( bytes > syncPixelsAlloc ) {
+			syncPixels = (unsigned char *)realloc( syncPixels, bytes );
+			syncPixelsAlloc = bytes;
+		}
+		glReadPixels( 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, syncPixels );
+		frameSubmit( w, h, syncPixels );
+		return;
+	}
+
+	if( w != pboAllocW || h != pboAllocH ) {
+		// SIZE changed: collect what was in flight and reallocate the ring
+		for( int i=0; i<PBO_RING_SIZE; i++ ) {
+			pboCollect( ( pboNext + i ) % PBO_RING_SIZE );
+		}
+		pboFree();
+		(*captureGenBuffers)( PBO_RING_SIZE, pbos );
+		for( int i=0; i<PBO_RING_SIZE; i++ ) {
+			(*captureBindBuffer)( GL_PIXEL_PACK_BUFFER_ARB, pbos[i] );
+			(*captureBufferData)( GL_PIXEL_PACK_BUFFER_ARB, w * h * 4, 0, GL_STREAM_READ_ARB );
+		}
+		(*captureBindBuffer)( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+		pboAllocW = w;
+		pboAllocH = h;
+	}
+
+	// COLLECT the oldest read, which by now has had PBO_RING_SIZE-1 frames to complete
+	pboCollect( pboNext );
+
+	// ISSUE this frame's read into the same slot
+	(*captureBindBuffer)( GL_PIXEL_PACK_BUFFER_ARB, pbos[pboNext] );
+	glReadPixels( 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+	(*captureBindBuffer)( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+	pboW[pboNext] = w;
+	pboH[pboNext] = h;
+	pboPending[pboNext] = 1;
+	pboNext = ( pboNext + 1 ) % PBO_RING_SIZE;
+}
+
+// Start / stop
+//===============================================================================
+
+int zlabCaptureStart( char *dir, int format ) {
+	if( captureActive ) {
+		return 0;
+	}
+	strncpy( captureDir, dir, sizeof(captureDir)-1 );
+	captureDir[sizeof(captureDir)-1] = 0;
+	captureFormat = format;
+	framesWritten = 0;
+	framesDropped = 0;
+	rawW = rawH = 0;
+
+	if( captureFormat == ZLAB_CAPTURE_RAW ) {
+		char path[600];
+		sprintf( path, "%s/capture.rgb", captureDir );
+		rawFile = fopen( path, "wb" );
+		if( !rawFile ) {
+			trace( "zlabcapture: unable to open %s\n", path );
+			return 0;
+		}
+	}
+
+	#ifdef ZMSG_MULTITHREAD
+		encoderQuit = 0;
+		encoderRunning = !pthread_create( &encoderThread, 0, encoderThreadMain, 0 );
+		if( !encoderRunning ) {
+			trace( "zlabcapture: unable to start the encoder thread; encoding inline\n" );
+		}
+	#endif
+
+	captureActive = 1;
+	trace( "zlabcapture: capturing to %s\n", captureDir );
+	return 1;
+}
+
+void zlabCaptureStop() {
+	if( !captureActive ) {
+		return;
+	}
+
+	if( capturePBOSupported ) {
+		for( int i=0; i<PBO_RING_SIZE; i++ ) {
+			pboCollect( ( pboNext + i ) % PBO_RING_SIZE );
+		}
+		pboFree();
+	}
+	captureActive = 0;
+
+	#ifdef ZMSG_MULTITHREAD
+		if( encoderRunning ) {
+			CAPTURE_LOCK();
+			encoderQuit = 1;
+			pthread_cond_signal( &captureCond );
+			CAPTURE_UNLOCK();
+			pthread_join( encoderThread, 0 );
+			encoderRunning = 0;
+		}
+	#endif
+	CAPTURE_LOCK();
+	while( encodeNext() );
+	CAPTURE_UNLOCK();
+
+	if( rawFile ) {
+		fclose( rawFile );
+		rawFile = 0;
+		char path[600];
+		sprintf( path, "%s/capture.txt", captureDir );
+		FILE *f = fopen( path, "wt" );
+		if( f ) {
+			fprintf( f, "frames %d\nwidth %d\nheight %d\npixel_format rgb24\n", framesWritten, rawW, rawH );
+			fprintf( f, "ffmpeg -f rawvideo -pix_fmt rgb24 -s %dx%d -r 60 -i capture.rgb capture.mp4\n", rawW, rawH );
+			fclose( f );
+		}
+	}
+
+	trace( "zlabcapture: stopped, %d frames written, %d dropped\n", framesWritten, framesDropped );
+}
+
+int zlabCaptureIsActive() {
+	return captureActive;
+}
+
+int zlabCaptureFramesWritten() {
+	return framesWritten;
+}
+
+int zlabCaptureFramesDropped() {
+	return framesDropped;
+}
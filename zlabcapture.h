@@ -0,0 +1,38 @@
+#ifndef ZLABCAPTURE_H
+#define ZLABCAPTURE_H
+
+// Frame capture to a PNG sequence or a raw rgb24 video file.
+//
+// zlabCaptureFrame() is called once per frame after the plugin has rendered
+// and before the swap.  It starts an asynchronous read of the back buffer into
+// one of a ring of pixel buffer objects and collects the one started a couple
+// of frames earlier, so the GL pipeline is never waited on.  The pixels are then
+// written by an encoder thread.  If the encoder falls behind, frames are dropped
+// rather than stalling the render thread.
+//
+// Where GL_ARB_pixel_buffer_object is missing the read falls back to a plain
+// glReadPixels.  Without ZMSG_MULTITHREAD the encoding is done inline.
+
+enum ZlabCaptureFormat {
+	ZLAB_CAPTURE_PNG = 0,
+		// <dir>/frame_000000.png ...
+	ZLAB_CAPTURE_RAW
+		// <dir>/capture.rgb, top row first, plus <dir>/capture.txt giving the
+		// size and an ffmpeg command line to turn it into a video
+};
+
+int zlabCaptureStart( char *dir, int format );
+	// dir must exist.  Returns 0 if a capture is already running.
+
+void zlabCaptureStop();
+	// Collects the frames still in flight and waits for the encoder to finish
+
+int zlabCaptureIsActive();
+
+void zlabCaptureFrame( int w, int h );
+	// Main thread, with the frame to capture in the back buffer
+
+int zlabCaptureFramesWritten();
+int zlabCaptureFramesDropped();
+
+#endif
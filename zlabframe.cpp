@@ -0,0 +1,119 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Per-frame bump arena for main loop temporaries and a per-frame heap allocation counter
+//		}
+//		*REQUIRED_FILES zlabframe.cpp zlabframe.h zlabmemtrack.cpp zlabmemtrack.h
+// }
+
+// STDLIB includes:
+#include "stdio.h"
+#include "stdlib.h"
+#include "stdarg.h"
+#include "string.h"
+#include "assert.h"
+// MODULE includes:
+#include "zlabframe.h"
+#include "zlabmemtrack.h"
+
+// Arena
+//===============================================================================
+
+static char *arenaBase = 0;
+static int arenaSize = 0;
+static int arenaUsed = 0;
+
+struct ArenaOverflowBlock {
+	ArenaOverflowBlock *next;
+};
+static ArenaOverflowBlock *overflowBlocks = 0;
+static int overflowBytes = 0;
+	// Requests that don't fit in the arena get their own heap block for the rest
+	// of the frame, and the arena is grown by that much at the next reset.
+
+static const int ARENA_INITIAL_SIZE = 64 * 1024;
+static const int ARENA_ALIGN = 16;
+
+void *zlabFrameAlloc( int bytes ) {
+	assert( bytes >= 0 );
+	bytes = ( bytes + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 );
+	if( !arenaBase ) {
+		arenaSize = ARENA_INITIAL_SIZE;
+		arenaBase = (char *)malloc( arenaSize );
+		arenaUsed = 0;
+	}
+	if( arenaUsed + bytes <= arenaSize ) {
+		void *p = arenaBase + arenaUsed;
+		arenaUsed += bytes;
+		return p;
+	}
+
+	// OVERFLOW: use a heap block for now, grow the arena at the next reset
+	ArenaOverflowBlock *block = (ArenaOverflowBlock *)malloc( ARENA_ALIGN + bytes );
+	block->next = overflowBlocks;
+	overflowBlocks = block;
+	overflowBytes += bytes;
+	return (char *)block + ARENA_ALIGN;
+}
+
+char *zlabFrameStr( char *fmt, ... ) {
+	char buffer[1024];
+	va_list argptr;
+	va_start( argptr, fmt );
+	#ifdef WIN32
+		_vsnprintf( buffer, sizeof(buffer), fmt, argptr );
+	#else
+		vsnprintf( buffer, sizeof(buffer), fmt, argptr );
+	#endif
+	va_end( argptr );
+	buffer[sizeof(buffer)-1] = 0;
+
+	int len = (int)strlen( buffer );
+	char *s = (char *)zlabFrameAlloc( len + 1 );
+	memcpy( s, buffer, len + 1 );
+	return s;
+}
+
+int zlabFrameArenaSize() {
+	return arenaSize;
+}
+
+int zlabFrameArenaUsed() {
+	return arenaUsed + overflowBytes;
+}
+
+// Allocation counting
+//===============================================================================
+
+static long long heapAllocsAtFrameStart = 0;
+static int heapAllocsLastFrame = -1;
+
+int zlabFrameHeapAllocs() {
+	return heapAllocsLastFrame;
+}
+
+// Frame
+//===============================================================================
+
+void zlabFrameBegin() {
+	long long count = zlabMemAllocCount();
+	if( count >= 0 ) {
+		heapAllocsLastFrame = (int)( count - heapAllocsAtFrameStart );
+		heapAllocsAtFrameStart = count;
+	}
+	zlabMemTrackFrame();
+
+	if( overflowBlocks ) {
+		// GROW the arena so that a frame like the last one fits
+		while( overflowBlocks ) {
+			ArenaOverflowBlock *next = overflowBlocks->next;
+			free( overflowBlocks );
+			overflowBlocks = next;
+		}
+		free( arenaBase );
+		arenaSize += overflowBytes;
+		arenaSize = ( arenaSize + ARENA_INITIAL_SIZE - 1 ) & ~( ARENA_INITIAL_SIZE - 1 );
+		arenaBase = (char *)malloc( arenaSize );
+		overflowBytes = 0;
+	}
+	arenaUsed = 0;
+}
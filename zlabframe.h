@@ -0,0 +1,34 @@
+#ifndef ZLABFRAME_H
+#define ZLABFRAME_H
+
+// Per-frame scratch memory for the main loop.
+//
+// zlabFrameAlloc() and zlabFrameStr() hand out memory from a bump arena that
+// is reset by zlabFrameBegin() at the top of every main loop iteration, so
+// nothing allocated from it may be kept past the current frame.  The arena
+// grows (once) to the largest frame it has seen, after which a frame costs no
+// heap allocations at all.  Main thread only.
+//
+// When built with ZLAB_ALLOC_COUNT or ZLAB_MEMTRACK defined (see zlabmemtrack.h)
+// heap allocations from every thread are counted so that the per-frame count
+// can be shown in the zprof overlay.
+
+void zlabFrameBegin();
+	// Called once at the top of the main loop; resets the arena and latches the
+	// allocation count of the frame that just finished.
+
+void *zlabFrameAlloc( int bytes );
+	// Returns 16-byte aligned scratch memory valid until the next zlabFrameBegin()
+
+char *zlabFrameStr( char *fmt, ... );
+	// sprintf into scratch memory valid until the next zlabFrameBegin().
+	// Output longer than 1023 characters is truncated.
+
+int zlabFrameArenaSize();
+int zlabFrameArenaUsed();
+	// Capacity and the bytes used so far this frame
+
+int zlabFrameHeapAllocs();
+	// Heap allocations made during the previous frame, -1 if not counted in this build
+
+#endif
@@ -0,0 +1,627 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Shadows GL state so that calls which would not change it never reach the driver
+//		}
+//		*REQUIRED_FILES zlabglstate.cpp zlabglstate.h
+// }
+
+#if defined(__linux__) && !defined(ZLAB_NO_GLSTATE)
+	#define GLSTATE_SHADOW
+#endif
+
+// OPERATING SYSTEM specific includes:
+#ifdef WIN32
+#include "windows.h"
+#endif
+#ifdef GLSTATE_SHADOW
+#include "dlfcn.h"
+#endif
+// SDK includes:
+#ifdef __APPLE__
+#include "OpenGL/gl.h"
+#else
+#include "GL/gl.h"
+#endif
+// STDLIB includes:
+#include "stdio.h"
+#include "string.h"
+// MODULE includes:
+#include "zlabglstate.h"
+
+#ifndef GLSTATE_SHADOW
+
+void zlabGLStateEnable( int enable ) {
+}
+
+void zlabGLStateInvalidate() {
+}
+
+void zlabGLStateFrame() {
+}
+
+int zlabGLStateIssuedLastFrame() {
+	return -1;
+}
+
+int zlabGLStateElidedLastFrame() {
+	return -1;
+}
+
+#else
+
+// Shadow
+//===============================================================================
+// GL calls are only made from the main thread, so none of this is locked.
+
+static int shadowEnabled = 1;
+static int compilingList = 0;
+static GLenum compilingMode = 0;
+static int listsChangeUnit = 0;
+	// set once any display list has been compiled with a glActiveTexture in it
+static int issued = 0;
+static int elided = 0;
+static int issuedLastFrame = 0;
+static int elidedLastFrame = 0;
+
+static const GLenum trackedCaps[] = {
+	GL_BLEND, GL_DEPTH_TEST, GL_SCISSOR_TEST, GL_TEXTURE_2D, GL_LIGHTING,
+	GL_CULL_FACE, GL_ALPHA_TEST, GL_STENCIL_TEST, GL_LINE_SMOOTH, GL_POINT_SMOOTH,
+	GL_POLYGON_SMOOTH, GL_COLOR_MATERIAL, GL_NORMALIZE, GL_FOG, GL_DITHER,
+	GL_POLYGON_OFFSET_FILL, GL_LINE_STIPPLE,
+};
+static const int TRACKED_CAP_COUNT = sizeof(trackedCaps) / sizeof(trackedCaps[0]);
+
+#define SHADOW_TEXTURE_UNITS (8)
+	// GL_TEXTURE_1D and GL_TEXTURE_2D are enabled per texture unit; units past
+	// these are not shadowed
+
+struct GLShadow {
+	// caps are 1, 0, or -1 for unknown; the rest are valid when their Known flag is set
+	int caps[ sizeof(trackedCaps) / sizeof(trackedCaps[0]) ];
+	int textureCaps[SHADOW_TEXTURE_UNITS][2];
+		// [unit][0] is GL_TEXTURE_1D, [unit][1] GL_TEXTURE_2D
+	int activeUnit;
+		// -1 when unknown; followed through glActiveTexture, never queried
+	GLenum blendSrc, blendDst;
+	int blendKnown;
+	GLenum matrixMode;
+	int matrixModeKnown;
+	GLint scissor[4];
+	int scissorKnown;
+	GLint viewport[4];
+	int viewportKnown;
+	GLenum readBuffer, drawBuffer;
+	int readBufferKnown, drawBufferKnown;
+	GLclampf clearColor[4];
+	int clearColorKnown;
+	GLfloat lineWidth, pointSize;
+	int lineWidthKnown, pointSizeKnown;
+	GLenum shadeModel;
+	int shadeModelKnown;
+};
+static GLShadow shadow;
+static int shadowInitialized = 0;
+
+#define ATTRIB_STACK_DEPTH (16)
+	// the smallest GL_MAX_ATTRIB_STACK_DEPTH GL allows
+static int attribUnits[ATTRIB_STACK_DEPTH];
+	// the active unit at each glPushAttrib, or -2 when GL_TEXTURE_BIT wasn't pushed
+static int attribDepth = 0;
+
+#define SHADOW_CONTEXTS (8)
+static void *contexts[SHADOW_CONTEXTS];
+static int contextUnits[SHADOW_CONTEXTS];
+static int contextCount = 0;
+static void *currentContext = 0;
+
+static void shadowForget() {
+	// Forget every shadowed value but the active texture unit, which is
+	// followed separately
+	int activeUnit = shadowInitialized ? shadow.activeUnit : 0;
+		// a context starts out on unit 0
+	memset( &shadow, 0, sizeof(shadow) );
+	for( int i=0; i<TRACKED_CAP_COUNT; i++ ) {
+		shadow.caps[i] = -1;
+	}
+	for( int i=0; i<SHADOW_TEXTURE_UNITS; i++ ) {
+		shadow.textureCaps[i][0] = -1;
+		shadow.textureCaps[i][1] = -1;
+	}
+	shadow.activeUnit = activeUnit;
+	shadowInitialized = 1;
+}
+
+void zlabGLStateInvalidate() {
+	shadowForget();
+	shadow.activeUnit = -1;
+}
+
+void zlabGLStateEnable( int enable ) {
+	shadowEnabled = enable;
+	shadowForget();
+		// the active unit has been followed all along
+}
+
+void zlabGLStateFrame() {
+	issuedLastFrame = issued;
+	elidedLastFrame = elided;
+	issued = 0;
+	elided = 0;
+}
+
+int zlabGLStateIssuedLastFrame() {
+	return issuedLastFrame;
+}
+
+int zlabGLStateElidedLastFrame() {
+	return elidedLastFrame;
+}
+
+static int shadowing() {
+	if( !shadowInitialized ) {
+		shadowForget();
+	}
+	return shadowEnabled && !compilingList;
+}
+
+static void activeUnitSet( GLenum texture ) {
+	if( !shadowInitialized ) {
+		shadowForget();
+	}
+	if( compilingList ) {
+		// Lists may now move the unit when called
+		listsChangeUnit = 1;
+		if( compilingMode != GL_COMPILE_AND_EXECUTE ) {
+			return;
+		}
+	}
+	shadow.activeUnit = texture - GL_TEXTURE0;
+}
+
+static int *capShadow( GLenum cap ) {
+	// Where cap's state is kept, 0 if it isn't shadowed
+	if( cap == GL_TEXTURE_1D || cap == GL_TEXTURE_2D ) {
+		if( shadow.activeUnit < 0 || shadow.activeUnit >= SHADOW_TEXTURE_UNITS ) {
+			// Unknown until the next glActiveTexture; asking GL would cost
+			// a round trip on indirect GLX, more than the call saved
+			return 0;
+		}
+		return &shadow.textureCaps[ shadow.activeUnit ][ cap == GL_TEXTURE_2D ];
+	}
+	for( int i=0; i<TRACKED_CAP_COUNT; i++ ) {
+		if( trackedCaps[i] == cap ) {
+			return &shadow.caps[i];
+		}
+	}
+	return 0;
+}
+
+// Forwarding
+//===============================================================================
+// The real entry points are found in the next library along the search
+// order, libGL, the first time each is used.  Extension entry points that
+// libGL doesn't export are asked of glXGetProcAddressARB.
+
+typedef void (*GLProc)();
+
+extern "C" GLProc glXGetProcAddressARB( const GLubyte *name );
+
+static GLProc realProc( const char *name ) {
+	GLProc proc = (GLProc)dlsym( RTLD_NEXT, name );
+	if( !proc ) {
+		typedef GLProc (*Fn)( const GLubyte * );
+		static Fn realGetProcAddress = (Fn)dlsym( RTLD_NEXT, "glXGetProcAddressARB" );
+		if( realGetProcAddress ) {
+			proc = (*realGetProcAddress)( (const GLubyte *)name );
+		}
+	}
+	return proc;
+}
+
+#define REAL( name, type ) \
+	static type real_##name = 0; \
+	if( !real_##name ) { \
+		real_##name = (type)realProc( #name ); \
+	}
+
+extern "C" {
+
+void GLAPIENTRY glEnable( GLenum cap ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glEnable, Fn );
+	int *c = shadowing() ? capShadow( cap ) : 0;
+	if( c ) {
+		if( *c == 1 ) {
+			elided++;
+			return;
+		}
+		*c = 1;
+	}
+	issued++;
+	real_glEnable( cap );
+}
+
+void GLAPIENTRY glDisable( GLenum cap ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glDisable, Fn );
+	int *c = shadowing() ? capShadow( cap ) : 0;
+	if( c ) {
+		if( *c == 0 ) {
+			elided++;
+			return;
+		}
+		*c = 0;
+	}
+	issued++;
+	real_glDisable( cap );
+}
+
+void GLAPIENTRY glBlendFunc( GLenum sfactor, GLenum dfactor ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum, GLenum );
+	REAL( glBlendFunc, Fn );
+	if( shadowing() ) {
+		if( shadow.blendKnown && shadow.blendSrc == sfactor && shadow.blendDst == dfactor ) {
+			elided++;
+			return;
+		}
+		shadow.blendSrc = sfactor;
+		shadow.blendDst = dfactor;
+		shadow.blendKnown = 1;
+	}
+	issued++;
+	real_glBlendFunc( sfactor, dfactor );
+}
+
+void GLAPIENTRY glMatrixMode( GLenum mode ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glMatrixMode, Fn );
+	if( shadowing() ) {
+		if( shadow.matrixModeKnown && shadow.matrixMode == mode ) {
+			elided++;
+			return;
+		}
+		shadow.matrixMode = mode;
+		shadow.matrixModeKnown = 1;
+	}
+	issued++;
+	real_glMatrixMode( mode );
+}
+
+void GLAPIENTRY glScissor( GLint x, GLint y, GLsizei width, GLsizei height ) {
+	typedef void (GLAPIENTRY *Fn)( GLint, GLint, GLsizei, GLsizei );
+	REAL( glScissor, Fn );
+	if( shadowing() ) {
+		GLint *s = shadow.scissor;
+		if( shadow.scissorKnown && s[0] == x && s[1] == y && s[2] == width && s[3] == height ) {
+			elided++;
+			return;
+		}
+		s[0] = x; s[1] = y; s[2] = width; s[3] = height;
+		shadow.scissorKnown = 1;
+	}
+	issued++;
+	real_glScissor( x, y, width, height );
+}
+
+void GLAPIENTRY glViewport( GLint x, GLint y, GLsizei width, GLsizei height ) {
+	typedef void (GLAPIENTRY *Fn)( GLint, GLint, GLsizei, GLsizei );
+	REAL( glViewport, Fn );
+	if( shadowing() ) {
+		GLint *v = shadow.viewport;
+		if( shadow.viewportKnown && v[0] == x && v[1] == y && v[2] == width && v[3] == height ) {
+			elided++;
+			return;
+		}
+		v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+		shadow.viewportKnown = 1;
+	}
+	issued++;
+	real_glViewport( x, y, width, height );
+}
+
+void GLAPIENTRY glReadBuffer( GLenum mode ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glReadBuffer, Fn );
+	if( shadowing() ) {
+		if( shadow.readBufferKnown && shadow.readBuffer == mode ) {
+			elided++;
+			return;
+		}
+		shadow.readBuffer = mode;
+		shadow.readBufferKnown = 1;
+	}
+	issued++;
+	real_glReadBuffer( mode );
+}
+
+void GLAPIENTRY glDrawBuffer( GLenum mode ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glDrawBuffer, Fn );
+	if( shadowing() ) {
+		if( shadow.drawBufferKnown && shadow.drawBuffer == mode ) {
+			elided++;
+			return;
+		}
+		shadow.drawBuffer = mode;
+		shadow.drawBufferKnown = 1;
+	}
+	issued++;
+	real_glDrawBuffer( mode );
+}
+
+void GLAPIENTRY glClearColor( GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha ) {
+	typedef void (GLAPIENTRY *Fn)( GLclampf, GLclampf, GLclampf, GLclampf );
+	REAL( glClearColor, Fn );
+	if( shadowing() ) {
+		GLclampf *c = shadow.clearColor;
+		if( shadow.clearColorKnown && c[0] == red && c[1] == green && c[2] == blue && c[3] == alpha ) {
+			elided++;
+			return;
+		}
+		c[0] = red; c[1] = green; c[2] = blue; c[3] = alpha;
+		shadow.clearColorKnown = 1;
+	}
+	issued++;
+	real_glClearColor( red, green, blue, alpha );
+}
+
+void GLAPIENTRY glLineWidth( GLfloat width ) {
+	typedef void (GLAPIENTRY *Fn)( GLfloat );
+	REAL( glLineWidth, Fn );
+	if( shadowing() ) {
+		if( shadow.lineWidthKnown && shadow.lineWidth == width ) {
+			elided++;
+			return;
+		}
+		shadow.lineWidth = width;
+		shadow.lineWidthKnown = 1;
+	}
+	issued++;
+	real_glLineWidth( width );
+}
+
+void GLAPIENTRY glPointSize( GLfloat size ) {
+	typedef void (GLAPIENTRY *Fn)( GLfloat );
+	REAL( glPointSize, Fn );
+	if( shadowing() ) {
+		if( shadow.pointSizeKnown && shadow.pointSize == size ) {
+			elided++;
+			return;
+		}
+		shadow.pointSize = size;
+		shadow.pointSizeKnown = 1;
+	}
+	issued++;
+	real_glPointSize( size );
+}
+
+void GLAPIENTRY glShadeModel( GLenum mode ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glShadeModel, Fn );
+	if( shadowing() ) {
+		if( shadow.shadeModelKnown && shadow.shadeModel == mode ) {
+			elided++;
+			return;
+		}
+		shadow.shadeModel = mode;
+		shadow.shadeModelKnown = 1;
+	}
+	issued++;
+	real_glShadeModel( mode );
+}
+
+void GLAPIENTRY glActiveTexture( GLenum texture ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glActiveTexture, Fn );
+	real_glActiveTexture( texture );
+	activeUnitSet( texture );
+}
+
+void GLAPIENTRY glActiveTextureARB( GLenum texture ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum );
+	REAL( glActiveTextureARB, Fn );
+	real_glActiveTextureARB( texture );
+	activeUnitSet( texture );
+}
+
+// These change shadowed state in ways it doesn't model, so it forgets that part
+
+void GLAPIENTRY glBlendFuncSeparate( GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum, GLenum, GLenum, GLenum );
+	REAL( glBlendFuncSeparate, Fn );
+	real_glBlendFuncSeparate( srcRGB, dstRGB, srcAlpha, dstAlpha );
+	shadow.blendKnown = 0;
+}
+
+void GLAPIENTRY glBlendFuncSeparateEXT( GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum, GLenum, GLenum, GLenum );
+	REAL( glBlendFuncSeparateEXT, Fn );
+	real_glBlendFuncSeparateEXT( srcRGB, dstRGB, srcAlpha, dstAlpha );
+	shadow.blendKnown = 0;
+}
+
+void GLAPIENTRY glBindFramebuffer( GLenum target, GLuint framebuffer ) {
+	// Draw and read buffers belong to the framebuffer
+	typedef void (GLAPIENTRY *Fn)( GLenum, GLuint );
+	REAL( glBindFramebuffer, Fn );
+	real_glBindFramebuffer( target, framebuffer );
+	shadow.drawBufferKnown = 0;
+	shadow.readBufferKnown = 0;
+}
+
+void GLAPIENTRY glBindFramebufferEXT( GLenum target, GLuint framebuffer ) {
+	typedef void (GLAPIENTRY *Fn)( GLenum, GLuint );
+	REAL( glBindFramebufferEXT, Fn );
+	real_glBindFramebufferEXT( target, framebuffer );
+	shadow.drawBufferKnown = 0;
+	shadow.readBufferKnown = 0;
+}
+
+// These change state behind the shadow's back, so it forgets what it knew.
+// The active unit is only forgotten when it may really have moved.
+
+void GLAPIENTRY glPushAttrib( GLbitfield mask ) {
+	typedef void (GLAPIENTRY *Fn)( GLbitfield );
+	REAL( glPushAttrib, Fn );
+	real_glPushAttrib( mask );
+	if( compilingList && compilingMode != GL_COMPILE_AND_EXECUTE ) {
+		return;
+	}
+	if( attribDepth < ATTRIB_STACK_DEPTH ) {
+		attribUnits[attribDepth] = ( mask & GL_TEXTURE_BIT ) ? ( shadowInitialized ? shadow.activeUnit : 0 ) : -2;
+	}
+	attribDepth++;
+}
+
+void GLAPIENTRY glPopAttrib() {
+	typedef void (GLAPIENTRY *Fn)();
+	REAL( glPopAttrib, Fn );
+	real_glPopAttrib();
+	if( compilingList && compilingMode != GL_COMPILE_AND_EXECUTE ) {
+		return;
+	}
+	shadowForget();
+	if( attribDepth > 0 && attribDepth <= ATTRIB_STACK_DEPTH ) {
+		int unit = attribUnits[ attribDepth - 1 ];
+		if( unit != -2 ) {
+			shadow.activeUnit = unit;
+		}
+	}
+	else {
+		// Pushed before we were watching, or deeper than we keep
+		shadow.activeUnit = -1;
+	}
+	if( attribDepth > 0 ) {
+		attribDepth--;
+	}
+}
+
+void GLAPIENTRY glCallList( GLuint list ) {
+	typedef void (GLAPIENTRY *Fn)( GLuint );
+	REAL( glCallList, Fn );
+	real_glCallList( list );
+	if( listsChangeUnit ) {
+		zlabGLStateInvalidate();
+	}
+	else {
+		shadowForget();
+	}
+}
+
+void GLAPIENTRY glCallLists( GLsizei n, GLenum type, const GLvoid *lists ) {
+	typedef void (GLAPIENTRY *Fn)( GLsizei, GLenum, const GLvoid * );
+	REAL( glCallLists, Fn );
+	real_glCallLists( n, type, lists );
+	if( listsChangeUnit ) {
+		zlabGLStateInvalidate();
+	}
+	else {
+		shadowForget();
+	}
+}
+
+void GLAPIENTRY glNewList( GLuint list, GLenum mode ) {
+	// Calls made while compiling must all be recorded into the list
+	typedef void (GLAPIENTRY *Fn)( GLuint, GLenum );
+	REAL( glNewList, Fn );
+	real_glNewList( list, mode );
+	compilingList = 1;
+	compilingMode = mode;
+}
+
+void GLAPIENTRY glEndList() {
+	typedef void (GLAPIENTRY *Fn)();
+	REAL( glEndList, Fn );
+	real_glEndList();
+	compilingList = 0;
+	shadowForget();
+		// GL_COMPILE_AND_EXECUTE will have changed state unseen
+}
+
+int glXMakeCurrent( void *display, unsigned long drawable, void *context ) {
+	// Each context has its own state.  Its active unit is remembered from
+	// when it was last current; one not seen before is on unit 0.
+	typedef int (*Fn)( void *, unsigned long, void * );
+	REAL( glXMakeCurrent, Fn );
+	int ok = real_glXMakeCurrent( display, drawable, context );
+	if( !ok || context == currentContext ) {
+		return ok;
+	}
+	int unit = contextCount < SHADOW_CONTEXTS ? 0 : -1, i;
+		// once the table is full, a context not in it may have been seen before
+	for( i=0; i<contextCount; i++ ) {
+		if( contexts[i] == currentContext ) {
+			contextUnits[i] = shadowInitialized ? shadow.activeUnit : 0;
+			break;
+		}
+	}
+	if( i == contextCount && currentContext && contextCount < SHADOW_CONTEXTS ) {
+		contexts[contextCount] = currentContext;
+		contextUnits[contextCount] = shadowInitialized ? shadow.activeUnit : 0;
+		contextCount++;
+	}
+	for( i=0; i<contextCount; i++ ) {
+		if( contexts[i] == context ) {
+			unit = contextUnits[i];
+			break;
+		}
+	}
+	currentContext = context;
+	shadowForget();
+	shadow.activeUnit = unit;
+	attribDepth = 0;
+	return ok;
+}
+
+// Entry points fetched by name (GLEW, plugins) must also come here, or state
+// set through them would go unseen
+
+static const struct { const char *name; GLProc proc; } ownProcs[] = {
+	{ "glEnable", (GLProc)glEnable },
+	{ "glDisable", (GLProc)glDisable },
+	{ "glBlendFunc", (GLProc)glBlendFunc },
+	{ "glMatrixMode", (GLProc)glMatrixMode },
+	{ "glScissor", (GLProc)glScissor },
+	{ "glViewport", (GLProc)glViewport },
+	{ "glReadBuffer", (GLProc)glReadBuffer },
+	{ "glDrawBuffer", (GLProc)glDrawBuffer },
+	{ "glClearColor", (GLProc)glClearColor },
+	{ "glLineWidth", (GLProc)glLineWidth },
+	{ "glPointSize", (GLProc)glPointSize },
+	{ "glShadeModel", (GLProc)glShadeModel },
+	{ "glActiveTexture", (GLProc)glActiveTexture },
+	{ "glActiveTextureARB", (GLProc)glActiveTextureARB },
+	{ "glBlendFuncSeparate", (GLProc)glBlendFuncSeparate },
+	{ "glBlendFuncSeparateEXT", (GLProc)glBlendFuncSeparateEXT },
+	{ "glBindFramebuffer", (GLProc)glBindFramebuffer },
+	{ "glBindFramebufferEXT", (GLProc)glBindFramebufferEXT },
+	{ "glPushAttrib", (GLProc)glPushAttrib },
+	{ "glPopAttrib", (GLProc)glPopAttrib },
+	{ "glCallList", (GLProc)glCallList },
+	{ "glCallLists", (GLProc)glCallLists },
+	{ "glNewList", (GLProc)glNewList },
+	{ "glEndList", (GLProc)glEndList },
+};
+
+static GLProc getProcAddress( const char *realName, const GLubyte *name ) {
+	for( unsigned int i=0; i<sizeof(ownProcs)/sizeof(ownProcs[0]); i++ ) {
+		if( !strcmp( ownProcs[i].name, (const char *)name ) ) {
+			return ownProcs[i].proc;
+		}
+	}
+	typedef GLProc (*Fn)( const GLubyte * );
+	Fn real = (Fn)dlsym( RTLD_NEXT, realName );
+	return real ? (*real)( name ) : 0;
+}
+
+GLProc glXGetProcAddressARB( const GLubyte *name ) {
+	return getProcAddress( "glXGetProcAddressARB", name );
+}
+
+GLProc glXGetProcAddress( const GLubyte *name ) {
+	return getProcAddress( "glXGetProcAddress", name );
+}
+
+}
+
+#endif
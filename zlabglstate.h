@@ -0,0 +1,48 @@
+#ifndef ZLABGLSTATE_H
+#define ZLABGLSTATE_H
+
+// GL state shadow.
+//
+// On Linux this module defines the GL state setters listed below itself, so
+// that every caller in the process (main.cpp, the ZUI renderers, plugins,
+// zprof, GLU) goes through it before reaching libGL.  A call that would set a
+// state to the value it already has is dropped; the rest are forwarded.  On
+// software GL and remote X each dropped call is a saved round of validation or
+// protocol traffic.
+//
+//   glEnable / glDisable (common capabilities), glBlendFunc, glMatrixMode,
+//   glScissor, glViewport, glReadBuffer, glDrawBuffer, glClearColor,
+//   glLineWidth, glPointSize, glShadeModel
+//
+// The shadow starts out knowing nothing and learns values as they are set.
+// Texture enables are kept per texture unit; the active unit is followed
+// through glActiveTexture, glPushAttrib/glPopAttrib and glXMakeCurrent and
+// never read back from GL, since on indirect GLX that is a round trip.  While
+// the unit is unknown, texture enables are forwarded.  The shadow forgets
+// blending after glBlendFuncSeparate, draw and read buffers after a
+// framebuffer bind, and everything else after glPopAttrib, glCallList(s) and
+// glXMakeCurrent.  It stands aside while a display list is being compiled.
+// glXGetProcAddress(ARB) hands out these versions too, so state set through
+// fetched pointers is seen.
+//
+// State changed any other way, e.g. glEnablei or a library that opens libGL
+// itself, leaves the shadow stale and a later call wrongly dropped.  Set the
+// glStateShadow option to 0 to forward everything if that happens.
+//
+// Elsewhere, or when built with ZLAB_NO_GLSTATE, nothing is shadowed and the
+// counts below are -1.
+
+void zlabGLStateEnable( int enable );
+	// On by default; when off every call is forwarded (and counted as issued)
+
+void zlabGLStateInvalidate();
+	// Forget all shadowed values, e.g. after changing GL context
+
+void zlabGLStateFrame();
+	// Once per frame from the main loop; latches the counts below
+
+int zlabGLStateIssuedLastFrame();
+int zlabGLStateElidedLastFrame();
+	// Shadowed calls forwarded to / dropped before GL during the previous frame
+
+#endif
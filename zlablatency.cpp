@@ -0,0 +1,75 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Input-to-swap latency percentiles
+//		}
+//		*REQUIRED_FILES zlablatency.cpp zlablatency.h
+// }
+
+// STDLIB includes:
+#include "stdlib.h"
+#include "string.h"
+// MODULE includes:
+#include "zlablatency.h"
+
+#define LATENCY_SAMPLES (1024)
+
+static double samples[LATENCY_SAMPLES];
+static int sampleNext = 0;
+static int sampleCount = 0;
+
+static double pending = 0.0;
+	// when the oldest input not yet shown was seen, 0 if none
+static double pendingNext = 0.0;
+	// the same for input seen during the current swap
+static int inSwap = 0;
+
+void zlabLatencyInput( double t ) {
+	double &p = inSwap ? pendingNext : pending;
+	if( p == 0.0 || t < p ) {
+		p = t;
+	}
+}
+
+void zlabLatencyInputNextFrame( double t ) {
+	if( pendingNext == 0.0 || t < pendingNext ) {
+		pendingNext = t;
+	}
+}
+
+void zlabLatencySwapBegin() {
+	inSwap = 1;
+}
+
+void zlabLatencySwapEnd( double t ) {
+	if( pending != 0.0 ) {
+		samples[sampleNext] = t - pending;
+		sampleNext = ( sampleNext + 1 ) % LATENCY_SAMPLES;
+		if( sampleCount < LATENCY_SAMPLES ) {
+			sampleCount++;
+		}
+	}
+	pending = pendingNext;
+	pendingNext = 0.0;
+	inSwap = 0;
+}
+
+static int doubleCompare( const void *a, const void *b ) {
+	double da = *(double *)a;
+	double db = *(double *)b;
+	return da < db ? -1 : ( da > db ? 1 : 0 );
+}
+
+int zlabLatencyPercentiles( double &p50, double &p90, double &p99, double &max ) {
+	p50 = p90 = p99 = max = 0.0;
+	if( sampleCount == 0 ) {
+		return 0;
+	}
+	double sorted[LATENCY_SAMPLES];
+	memcpy( sorted, samples, sizeof(double) * sampleCount );
+	qsort( sorted, sampleCount, sizeof(double), doubleCompare );
+	p50 = sorted[ sampleCount * 50 / 100 ];
+	p90 = sorted[ sampleCount * 90 / 100 ];
+	p99 = sorted[ sampleCount * 99 / 100 ];
+	max = sorted[ sampleCount - 1 ];
+	return sampleCount;
+}
@@ -0,0 +1,31 @@
+#ifndef ZLABLATENCY_H
+#define ZLABLATENCY_H
+
+// Input-to-swap latency measurement.
+//
+// The main loop reports when it first sees each input event and when each
+// frame's swap starts and returns.  An event seen before a swap started is
+// shown by that swap; its latency is the time from being seen to the swap
+// returning, which with vsync on is close to when it reached the screen.  Only
+// the first event waiting for each frame is measured, since it waited longest.
+//
+// Events are seen when glfw polls them, so the time the event spent queued
+// before that is not included.  Main thread only.
+
+void zlabLatencyInput( double t );
+	// An input event was first seen at t (seconds)
+
+void zlabLatencyInputNextFrame( double t );
+	// The same for an event that the frame being drawn won't show
+
+void zlabLatencySwapBegin();
+void zlabLatencySwapEnd( double t );
+	// Begin once the frame is drawn, end when the swap returns at t.  Input
+	// seen in between (glfw polls events inside the swap, and a pipelined
+	// update runs before it) waits for the next swap.
+
+int zlabLatencyPercentiles( double &p50, double &p90, double &p99, double &max );
+	// Over the most recent 1024 frames that showed input, in seconds.
+	// Returns the number of samples, 0 if there are none yet.
+
+#endif
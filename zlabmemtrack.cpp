@@ -0,0 +1,434 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Heap allocation counting and per-subsystem memory accounting, enabled by ZLAB_ALLOC_COUNT or ZLAB_MEMTRACK
+//		}
+//		*REQUIRED_FILES zlabmemtrack.cpp zlabmemtrack.h
+// }
+
+// OPERATING SYSTEM specific includes:
+#ifdef WIN32
+#include "windows.h"
+#else
+#include "unistd.h"
+#include "dlfcn.h"
+#endif
+// STDLIB includes:
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include "new"
+// MODULE includes:
+#include "zlabmemtrack.h"
+
+#if defined(ZLAB_MEMTRACK) && !defined(ZLAB_ALLOC_COUNT)
+	#define ZLAB_ALLOC_COUNT
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__)
+	#define MEMTRACK_GLIBC
+#endif
+
+#ifdef WIN32
+	#define ATOMIC_ADD64(p,v) InterlockedExchangeAdd64( (volatile LONGLONG *)(p), (v) )
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define ATOMIC_ADD64(p,v) __sync_fetch_and_add( (p), (long long)(v) )
+	#define THREAD_LOCAL __thread
+#endif
+
+static char *tagNames[ZLAB_MEM_TAG_COUNT] = { "other", "zui", "msg", "font", "plugin" };
+
+char *zlabMemTagName( int tag ) {
+	return tag >= 0 && tag < ZLAB_MEM_TAG_COUNT ? tagNames[tag] : (char *)"?";
+}
+
+// Counters
+//===============================================================================
+
+static volatile long long allocCount = 0;
+	// counting mode only; full mode sums tagAllocs
+
+static volatile long long tagLive[ZLAB_MEM_TAG_COUNT];
+static volatile long long tagPeak[ZLAB_MEM_TAG_COUNT];
+static volatile long long tagBlocks[ZLAB_MEM_TAG_COUNT];
+static volatile long long tagAllocs[ZLAB_MEM_TAG_COUNT];
+static long long tagAllocsAtFrameStart[ZLAB_MEM_TAG_COUNT];
+static int tagAllocsLastFrame[ZLAB_MEM_TAG_COUNT];
+
+#ifdef ZLAB_MEMTRACK
+
+static THREAD_LOCAL int currentTag = ZLAB_MEM_OTHER;
+
+int zlabMemTagSet( int tag ) {
+	int prev = currentTag;
+	currentTag = tag;
+	return prev;
+}
+
+static void account( int tag, long long bytes, int blocks ) {
+	long long live = ATOMIC_ADD64( &tagLive[tag], bytes ) + bytes;
+	ATOMIC_ADD64( &tagBlocks[tag], blocks );
+	if( blocks > 0 ) {
+		ATOMIC_ADD64( &tagAllocs[tag], 1 );
+		if( live > tagPeak[tag] ) {
+			tagPeak[tag] = live;
+				// racy, but only ever low by a little
+		}
+	}
+}
+
+// Every tracked block is preceded by a header recording its size and tag so
+// that free() can credit the right subsystem.  The header sits immediately
+// before the returned pointer; offset is the distance back to what the system
+// allocator returned, which is more than the header size for aligned blocks.
+
+struct BlockHeader {
+	unsigned int magic;
+	unsigned short tag;
+	unsigned short offset;
+	size_t size;
+};
+
+static const size_t HEADER_SIZE = 16;
+static const unsigned int BLOCK_MAGIC = 0x5A4D454Du;
+static const size_t MAX_TRACKED_ALIGN = 32768;
+	// offset must fit in the header
+
+typedef char BlockHeaderFits[ sizeof(BlockHeader) <= HEADER_SIZE ? 1 : -1 ];
+
+static void *blockInit( void *base, size_t offset, size_t size ) {
+	if( !base ) {
+		return 0;
+	}
+	char *user = (char *)base + offset;
+	BlockHeader *h = (BlockHeader *)( user - HEADER_SIZE );
+	h->magic = BLOCK_MAGIC;
+	h->tag = (unsigned short)currentTag;
+	h->offset = (unsigned short)offset;
+	h->size = size;
+	account( h->tag, (long long)size, 1 );
+	return user;
+}
+
+static BlockHeader *blockHeader( void *p ) {
+	BlockHeader *h = (BlockHeader *)( (char *)p - HEADER_SIZE );
+	return h->magic == BLOCK_MAGIC ? h : 0;
+}
+
+static void *blockRelease( BlockHeader *h ) {
+	// Returns the pointer to hand back to the system allocator
+	account( h->tag, -(long long)h->size, -1 );
+	h->magic = 0;
+	return (char *)h + HEADER_SIZE - h->offset;
+}
+
+#endif
+
+// Allocator hooks
+//===============================================================================
+
+#ifdef ZLAB_ALLOC_COUNT
+
+static inline void countAlloc() {
+	#ifndef ZLAB_MEMTRACK
+		ATOMIC_ADD64( &allocCount, 1 );
+	#endif
+}
+
+#ifdef MEMTRACK_GLIBC
+	// glibc lets the program replace malloc and friends; the originals stay
+	// reachable as __libc_*.  Everything, including C++ new, comes through here.
+	extern "C" {
+		extern void *__libc_malloc( size_t size );
+		extern void *__libc_calloc( size_t n, size_t size );
+		extern void *__libc_realloc( void *p, size_t size );
+		extern void *__libc_memalign( size_t align, size_t size );
+		extern void __libc_free( void *p );
+
+		void *malloc( size_t size ) {
+			countAlloc();
+			#ifdef ZLAB_MEMTRACK
+				if( size > (size_t)-1 - HEADER_SIZE ) {
+					errno = ENOMEM;
+					return 0;
+				}
+				return blockInit( __libc_malloc( size + HEADER_SIZE ), HEADER_SIZE, size );
+			#else
+				return __libc_malloc( size );
+			#endif
+		}
+
+		void *calloc( size_t n, size_t size ) {
+			#ifdef ZLAB_MEMTRACK
+				if( size && n > (size_t)-1 / size ) {
+					errno = ENOMEM;
+					return 0;
+				}
+				void *p = malloc( n * size );
+				if( p ) {
+					memset( p, 0, n * size );
+				}
+				return p;
+			#else
+				countAlloc();
+				return __libc_calloc( n, size );
+			#endif
+		}
+
+		void *realloc( void *p, size_t size ) {
+			#ifdef ZLAB_MEMTRACK
+				if( !p ) {
+					return malloc( size );
+				}
+				if( size == 0 ) {
+					free( p );
+					return 0;
+				}
+				BlockHeader *h = blockHeader( p );
+				if( !h ) {
+					// Not ours (allocated before tracking started); leave it untracked
+					return __libc_realloc( p, size );
+				}
+				if( h->offset != HEADER_SIZE ) {
+					// ALIGNED block: realloc can't preserve the alignment offset, so copy
+					void *q = malloc( size );
+					if( q ) {
+						memcpy( q, p, h->size < size ? h->size : size );
+						free( p );
+					}
+					return q;
+				}
+				if( size > (size_t)-1 - HEADER_SIZE ) {
+					errno = ENOMEM;
+					return 0;
+				}
+				int tag = h->tag;
+				size_t oldSize = h->size;
+				void *base = blockRelease( h );
+				void *newBase = __libc_realloc( base, size + HEADER_SIZE );
+				if( !newBase ) {
+					// The old block is still valid; restore its header and accounting
+					int prevTag = zlabMemTagSet( tag );
+					blockInit( base, HEADER_SIZE, oldSize );
+					zlabMemTagSet( prevTag );
+					ATOMIC_ADD64( &tagAllocs[tag], -1 );
+					return 0;
+				}
+				int prevTag = zlabMemTagSet( tag );
+					// a resized block stays charged to its original subsystem
+				void *q = blockInit( newBase, HEADER_SIZE, size );
+				zlabMemTagSet( prevTag );
+				return q;
+			#else
+				countAlloc();
+				return __libc_realloc( p, size );
+			#endif
+		}
+
+		#ifdef ZLAB_MEMTRACK
+		void free( void *p ) {
+			if( !p ) {
+				return;
+			}
+			BlockHeader *h = blockHeader( p );
+			__libc_free( h ? blockRelease( h ) : p );
+		}
+
+		void *memalign( size_t align, size_t size ) {
+			if( align > MAX_TRACKED_ALIGN ) {
+				return __libc_memalign( align, size );
+			}
+			size_t a = align < HEADER_SIZE ? HEADER_SIZE : align;
+			if( size > (size_t)-1 - a ) {
+				errno = ENOMEM;
+				return 0;
+			}
+			return blockInit( __libc_memalign( a, size + a ), a, size );
+		}
+
+		int posix_memalign( void **out, size_t align, size_t size ) {
+			if( !align || ( align & ( align - 1 ) ) || align % sizeof(void *) ) {
+				return EINVAL;
+			}
+			void *p = memalign( align, size );
+			if( !p ) {
+				return ENOMEM;
+			}
+			*out = p;
+			return 0;
+		}
+
+		void *aligned_alloc( size_t align, size_t size ) {
+			return memalign( align, size );
+		}
+
+		void *valloc( size_t size ) {
+			return memalign( sysconf( _SC_PAGESIZE ), size );
+		}
+
+		void *pvalloc( size_t size ) {
+			size_t page = sysconf( _SC_PAGESIZE );
+			return memalign( page, ( size + page - 1 ) & ~( page - 1 ) );
+		}
+
+		size_t malloc_usable_size( void *p ) {
+			if( !p ) {
+				return 0;
+			}
+			BlockHeader *h = blockHeader( p );
+			if( h ) {
+				return h->size;
+			}
+			// Not ours (e.g. over-aligned memalign); glibc exports no
+			// __libc_ name for this one, so ask the next definition
+			typedef size_t (*Fn)( void * );
+			static Fn real = (Fn)dlsym( RTLD_NEXT, "malloc_usable_size" );
+			return real ? real( p ) : 0;
+		}
+		#endif
+	}
+
+#else
+	// Elsewhere only C++ allocations are seen
+	static void *trackedNew( size_t size ) {
+		countAlloc();
+		#ifdef ZLAB_MEMTRACK
+			void *p = blockInit( malloc( size + HEADER_SIZE ), HEADER_SIZE, size );
+		#else
+			void *p = malloc( size ? size : 1 );
+		#endif
+		return p;
+	}
+
+	static void trackedDelete( void *p ) {
+		if( p ) {
+			#ifdef ZLAB_MEMTRACK
+				BlockHeader *h = blockHeader( p );
+				free( h ? blockRelease( h ) : p );
+			#else
+				free( p );
+			#endif
+		}
+	}
+
+	void *operator new( size_t size ) {
+		void *p = trackedNew( size );
+		if( !p ) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+
+	void *operator new[]( size_t size ) {
+		void *p = trackedNew( size );
+		if( !p ) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+
+	void *operator new( size_t size, const std::nothrow_t & ) throw() {
+		return trackedNew( size );
+	}
+
+	void *operator new[]( size_t size, const std::nothrow_t & ) throw() {
+		return trackedNew( size );
+	}
+
+	void operator delete( void *p ) throw() {
+		trackedDelete( p );
+	}
+
+	void operator delete[]( void *p ) throw() {
+		trackedDelete( p );
+	}
+
+	void operator delete( void *p, const std::nothrow_t & ) throw() {
+		trackedDelete( p );
+	}
+
+	void operator delete[]( void *p, const std::nothrow_t & ) throw() {
+		trackedDelete( p );
+	}
+#endif
+
+#endif
+
+// Queries
+//===============================================================================
+
+int zlabMemTrackLevel() {
+	#if defined(ZLAB_MEMTRACK)
+		return 2;
+	#elif defined(ZLAB_ALLOC_COUNT)
+		return 1;
+	#else
+		return 0;
+	#endif
+}
+
+long long zlabMemAllocCount() {
+	#if defined(ZLAB_MEMTRACK)
+		long long total = 0;
+		for( int i=0; i<ZLAB_MEM_TAG_COUNT; i++ ) {
+			total += tagAllocs[i];
+		}
+		return total;
+	#elif defined(ZLAB_ALLOC_COUNT)
+		return allocCount;
+	#else
+		return -1;
+	#endif
+}
+
+void zlabMemTagGetStats( int tag, ZlabMemTagStats &stats ) {
+	memset( &stats, 0, sizeof(stats) );
+	if( tag < 0 || tag >= ZLAB_MEM_TAG_COUNT ) {
+		return;
+	}
+	stats.liveBytes = tagLive[tag];
+	stats.peakBytes = tagPeak[tag];
+	stats.liveBlocks = tagBlocks[tag];
+	stats.allocs = tagAllocs[tag];
+	stats.allocsLastFrame = tagAllocsLastFrame[tag];
+}
+
+void zlabMemTrackFrame() {
+	for( int i=0; i<ZLAB_MEM_TAG_COUNT; i++ ) {
+		long long allocs = tagAllocs[i];
+		tagAllocsLastFrame[i] = (int)( allocs - tagAllocsAtFrameStart[i] );
+		tagAllocsAtFrameStart[i] = allocs;
+	}
+}
+
+int zlabMemTrackReport( char *path ) {
+	if( zlabMemTrackLevel() < 2 || !path ) {
+		return 0;
+	}
+
+	// SNAPSHOT first so that the file's own buffers don't show up in the figures
+	ZlabMemTagStats stats[ZLAB_MEM_TAG_COUNT];
+	for( int i=0; i<ZLAB_MEM_TAG_COUNT; i++ ) {
+		zlabMemTagGetStats( i, stats[i] );
+	}
+
+	FILE *f = fopen( path, "wt" );
+	if( !f ) {
+		return 0;
+	}
+	fprintf( f, "zlab memory report\n\n" );
+	fprintf( f, "Live figures are what was still allocated at exit: leaks, plus anything\n" );
+	fprintf( f, "that static destructors free afterwards.\n\n" );
+	fprintf( f, "%-8s %16s %12s %16s %14s\n", "tag", "live bytes", "live blocks", "peak bytes", "allocations" );
+	long long live = 0, blocks = 0, allocs = 0;
+	for( int i=0; i<ZLAB_MEM_TAG_COUNT; i++ ) {
+		fprintf( f, "%-8s %16lld %12lld %16lld %14lld\n", zlabMemTagName( i ), stats[i].liveBytes, stats[i].liveBlocks, stats[i].peakBytes, stats[i].allocs );
+		live += stats[i].liveBytes;
+		blocks += stats[i].liveBlocks;
+		allocs += stats[i].allocs;
+	}
+	fprintf( f, "%-8s %16lld %12lld %16s %14lld\n", "total", live, blocks, "", allocs );
+	fclose( f );
+	return 1;
+}
@@ -0,0 +1,72 @@
+#ifndef ZLABMEMTRACK_H
+#define ZLABMEMTRACK_H
+
+// Heap allocation tracking, off unless the build defines one of:
+//
+//   ZLAB_ALLOC_COUNT  count allocations only (cheap; feeds zlabFrameHeapAllocs)
+//   ZLAB_MEMTRACK     also account live and peak bytes by subsystem, and write
+//                     a report when the program exits
+//
+// Both work in release builds.  On glibc every malloc is seen, including those
+// made inside zbslib and the SDKs; elsewhere only C++ new/delete are.
+//
+// Allocations are charged to the subsystem tag current on the allocating
+// thread.  Bracket calls into a subsystem with a ZlabMemTagScope:
+//
+//   { ZlabMemTagScope tag( ZLAB_MEM_ZUI ); ZUI::zuiUpdate( zTime ); }
+//
+// A block is credited back to the tag it was allocated under when freed, so
+// per-tag live bytes are exact.  Peak figures are approximate under contention.
+
+enum ZlabMemTag {
+	ZLAB_MEM_OTHER = 0,
+	ZLAB_MEM_ZUI,
+	ZLAB_MEM_MSG,
+	ZLAB_MEM_FONT,
+	ZLAB_MEM_PLUGIN,
+	ZLAB_MEM_TAG_COUNT
+};
+
+struct ZlabMemTagStats {
+	long long liveBytes;
+	long long peakBytes;
+	long long liveBlocks;
+	long long allocs;
+		// since startup
+	int allocsLastFrame;
+};
+
+#ifdef ZLAB_MEMTRACK
+	int zlabMemTagSet( int tag );
+		// Returns the previous tag of the calling thread
+
+	struct ZlabMemTagScope {
+		int prev;
+		ZlabMemTagScope( int tag ) { prev = zlabMemTagSet( tag ); }
+		~ZlabMemTagScope() { zlabMemTagSet( prev ); }
+	};
+#else
+	struct ZlabMemTagScope {
+		ZlabMemTagScope( int ) { }
+	};
+#endif
+
+int zlabMemTrackLevel();
+	// 0 off, 1 counting (ZLAB_ALLOC_COUNT), 2 full (ZLAB_MEMTRACK)
+
+long long zlabMemAllocCount();
+	// Allocations since startup, -1 when not counted
+
+char *zlabMemTagName( int tag );
+
+void zlabMemTagGetStats( int tag, ZlabMemTagStats &stats );
+	// Zeroes when not ZLAB_MEMTRACK
+
+void zlabMemTrackFrame();
+	// Once per frame from the main loop; latches allocsLastFrame
+
+int zlabMemTrackReport( char *path );
+	// Writes live (leaked, at exit) and peak bytes by tag.  0 if not tracking
+	// or the file can't be written.
+
+#endif
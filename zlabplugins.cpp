@@ -0,0 +1,88 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Sorted registry of the linked plugins with cached entry points
+//		}
+//		*REQUIRED_FILES zlabplugins.cpp zlabplugins.h
+// }
+
+// STDLIB includes:
+#include "stdlib.h"
+#include "string.h"
+#include "assert.h"
+// MODULE includes:
+#include "zlabplugins.h"
+#include "mainutil.h"
+// ZBSLIB includes:
+#include "zhashtable.h"
+#include "zplugin.h"
+
+static ZlabPlugin *registry = 0;
+static int registryCount = 0;
+static int registryAlloc = 0;
+static int registryBuilt = 0;
+
+static int pluginCompare( const void *a, const void *b ) {
+	return strcmp( ((ZlabPlugin *)a)->name, ((ZlabPlugin *)b)->name );
+}
+
+void zlabPluginRegistryBuild() {
+	if( registryBuilt ) {
+		return;
+	}
+	registryBuilt = 1;
+
+	int last = -1;
+	ZHashTable *plugin = 0;
+	while( zPluginEnum( last, plugin ) ) {
+		char *name = plugin->getS( "name" );
+		if( !name || !*name ) {
+			continue;
+		}
+		if( strlen( name ) >= ZLAB_PLUGIN_NAME_MAX ) {
+			trace( "Plugin name '%s' is longer than %d characters; plugin ignored.\n", name, ZLAB_PLUGIN_NAME_MAX-1 );
+			continue;
+		}
+
+		if( registryCount == registryAlloc ) {
+			registryAlloc = registryAlloc ? registryAlloc * 2 : 64;
+			registry = (ZlabPlugin *)realloc( registry, sizeof(ZlabPlugin) * registryAlloc );
+			assert( registry );
+		}
+
+		ZlabPlugin &p = registry[registryCount++];
+		p.name = strdup( name );
+		p.properties = plugin;
+		p.startup = (ZlabPluginFnPtr)zPluginGetP( name, "startup" );
+		p.shutdown = (ZlabPluginFnPtr)zPluginGetP( name, "shutdown" );
+	}
+
+	qsort( registry, registryCount, sizeof(ZlabPlugin), pluginCompare );
+
+	// REPORT duplicate names; lookups will find only one of them
+	for( int i=1; i<registryCount; i++ ) {
+		if( !strcmp( registry[i-1].name, registry[i].name ) ) {
+			trace( "Plugin name '%s' is registered more than once.\n", registry[i].name );
+		}
+	}
+}
+
+int zlabPluginCount() {
+	zlabPluginRegistryBuild();
+	return registryCount;
+}
+
+ZlabPlugin *zlabPluginGet( int i ) {
+	zlabPluginRegistryBuild();
+	assert( i >= 0 && i < registryCount );
+	return &registry[i];
+}
+
+ZlabPlugin *zlabPluginFind( char *name ) {
+	zlabPluginRegistryBuild();
+	if( !name || !*name ) {
+		return 0;
+	}
+	ZlabPlugin key;
+	key.name = name;
+	return (ZlabPlugin *)bsearch( &key, registry, registryCount, sizeof(ZlabPlugin), pluginCompare );
+}
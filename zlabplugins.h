@@ -0,0 +1,37 @@
+#ifndef ZLABPLUGINS_H
+#define ZLABPLUGINS_H
+
+// Registry of the plugins linked into this executable.
+//
+// Built once from zPluginEnum() the first time it is used, after which every
+// plugin is in an array sorted by name with its entry points already resolved,
+// so switching plugins does not go back through zPluginGetP() string lookups.
+// Main thread only.
+
+class ZHashTable;
+
+#define ZLAB_PLUGIN_NAME_MAX (256)
+	// Including the terminator.  Plugins with longer names are reported by
+	// trace() and left out of the registry rather than truncated.
+
+typedef void (*ZlabPluginFnPtr)();
+
+struct ZlabPlugin {
+	char *name;
+	ZHashTable *properties;
+	ZlabPluginFnPtr startup;
+	ZlabPluginFnPtr shutdown;
+};
+
+void zlabPluginRegistryBuild();
+	// Optional; every other call builds the registry on first use
+
+int zlabPluginCount();
+
+ZlabPlugin *zlabPluginGet( int i );
+	// i in [0,zlabPluginCount()), in strcmp order of name
+
+ZlabPlugin *zlabPluginFind( char *name );
+	// Binary search by name; 0 if there is no such plugin
+
+#endif
@@ -0,0 +1,308 @@
+// @ZBS {
+//		+DESCRIPTION {
+//			Statistical CPU profiler writing folded stacks for flame graphs
+//		}
+//		*REQUIRED_FILES zlabsampler.cpp zlabsampler.h
+// }
+
+// OPERATING SYSTEM specific includes:
+#ifndef WIN32
+#include "signal.h"
+#include "sys/time.h"
+#include "execinfo.h"
+#include "dlfcn.h"
+#include "cxxabi.h"
+#include "pthread.h"
+#include "errno.h"
+#endif
+// STDLIB includes:
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+// MODULE includes:
+#include "zlabsampler.h"
+
+#ifdef WIN32
+
+int zlabSamplerStart( int hz, int maxSamples ) {
+	return 0;
+}
+
+void zlabSamplerStop() {
+}
+
+int zlabSamplerIsRunning() {
+	return 0;
+}
+
+int zlabSamplerSampleCount() {
+	return 0;
+}
+
+int zlabSamplerDump( char *path ) {
+	return 0;
+}
+
+#else
+
+// Sample ring
+//===============================================================================
+
+#define SAMPLER_MAX_DEPTH (48)
+#define SAMPLER_SKIP_FRAMES (2)
+	// the signal handler and the kernel's signal trampoline
+
+struct Sample {
+	volatile int depth;
+		// 0 while being written
+	pthread_t thread;
+	void *pc[SAMPLER_MAX_DEPTH];
+};
+
+static Sample *samples = 0;
+static int sampleCap = 0;
+static volatile long sampleNext = 0;
+	// total samples taken; the ring slot is sampleNext % sampleCap
+static pthread_t mainThread;
+static int running = 0;
+static int timerUsecs = 0;
+
+static void sampleHandler( int ) {
+	// Runs on whichever thread the profiling timer interrupted.  Claims a ring
+	// slot with an atomic increment so that threads never share one.
+	int savedErrno = errno;
+	long n = __sync_fetch_and_add( &sampleNext, 1 );
+	Sample *s = &samples[ n % sampleCap ];
+	s->depth = 0;
+	__sync_synchronize();
+	s->thread = pthread_self();
+	int depth = backtrace( s->pc, SAMPLER_MAX_DEPTH );
+	__sync_synchronize();
+	s->depth = depth;
+	errno = savedErrno;
+}
+
+static void setTimer( int usecs ) {
+	struct itimerval t;
+	t.it_interval.tv_sec = usecs / 1000000;
+	t.it_interval.tv_usec = usecs % 1000000;
+	t.it_value = t.it_interval;
+	setitimer( ITIMER_PROF, &t, 0 );
+}
+
+static void resume() {
+	struct sigaction sa;
+	memset( &sa, 0, sizeof(sa) );
+	sa.sa_handler = sampleHandler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset( &sa.sa_mask );
+	sigaction( SIGPROF, &sa, 0 );
+	setTimer( timerUsecs );
+	running = 1;
+}
+
+int zlabSamplerStart( int hz, int maxSamples ) {
+	zlabSamplerStop();
+	if( hz <= 0 || maxSamples <= 0 ) {
+		return 0;
+	}
+	if( maxSamples != sampleCap ) {
+		free( samples );
+		samples = (Sample *)malloc( sizeof(Sample) * maxSamples );
+		if( !samples ) {
+			sampleCap = 0;
+			return 0;
+		}
+		sampleCap = maxSamples;
+	}
+	memset( samples, 0, sizeof(Sample) * sampleCap );
+	sampleNext = 0;
+	mainThread = pthread_self();
+
+	// PRIME backtrace; its first call loads the unwinder, which must not
+	// happen inside the signal handler
+	void *pc[4];
+	backtrace( pc, 4 );
+
+	timerUsecs = hz > 1000000 ? 1 : 1000000 / hz;
+	resume();
+	return 1;
+}
+
+void zlabSamplerStop() {
+	if( running ) {
+		setTimer( 0 );
+		signal( SIGPROF, SIG_IGN );
+			// a signal already pending must not land in a freed ring
+		running = 0;
+	}
+}
+
+int zlabSamplerIsRunning() {
+	return running;
+}
+
+int zlabSamplerSampleCount() {
+	return (int)( sampleNext < sampleCap ? sampleNext : sampleCap );
+}
+
+// Symbols
+//===============================================================================
+
+struct SymbolEntry {
+	void *pc;
+	char *name;
+};
+
+static int pcCompare( const void *a, const void *b ) {
+	char *pa = (char *)((SymbolEntry *)a)->pc;
+	char *pb = (char *)((SymbolEntry *)b)->pc;
+	return pa < pb ? -1 : ( pa > pb ? 1 : 0 );
+}
+
+static char *symbolName( void *pc ) {
+	// Demangled function name, or module+offset.  ';' is the folded format's
+	// separator so it can't appear in names.
+	char buf[512];
+	Dl_info info;
+	if( dladdr( pc, &info ) && info.dli_sname ) {
+		int status = 0;
+		char *demangled = abi::__cxa_demangle( info.dli_sname, 0, 0, &status );
+		strncpy( buf, status == 0 && demangled ? demangled : info.dli_sname, sizeof(buf)-1 );
+		buf[sizeof(buf)-1] = 0;
+		free( demangled );
+	}
+	else if( dladdr( pc, &info ) && info.dli_fname ) {
+		const char *module = strrchr( info.dli_fname, '/' );
+		module = module ? module+1 : info.dli_fname;
+		sprintf( buf, "%.400s+0x%lx", module, (unsigned long)( (char *)pc - (char *)info.dli_fbase ) );
+	}
+	else {
+		sprintf( buf, "0x%lx", (unsigned long)pc );
+	}
+	for( char *c=buf; *c; c++ ) {
+		if( *c == ';' ) {
+			*c = ':';
+		}
+	}
+	return strdup( buf );
+}
+
+static void *framePC( Sample *s, int frame ) {
+	// Return addresses point after the call; step back into it.  The
+	// interrupted frame's pc is exact.
+	char *pc = (char *)s->pc[frame];
+	return frame == SAMPLER_SKIP_FRAMES ? pc : pc - 1;
+}
+
+// Dump
+//===============================================================================
+
+static int stringCompare( const void *a, const void *b ) {
+	return strcmp( *(char **)a, *(char **)b );
+}
+
+int zlabSamplerDump( char *path ) {
+	FILE *f = fopen( path, "wt" );
+	if( !f ) {
+		return -1;
+	}
+
+	int wasRunning = running;
+	zlabSamplerStop();
+
+	int count = zlabSamplerSampleCount();
+
+	// NAME every distinct pc once
+	int pcCount = 0;
+	for( int i=0; i<count; i++ ) {
+		if( samples[i].depth > SAMPLER_SKIP_FRAMES ) {
+			pcCount += samples[i].depth - SAMPLER_SKIP_FRAMES;
+		}
+	}
+	SymbolEntry *symbols = (SymbolEntry *)malloc( sizeof(SymbolEntry) * ( pcCount + 1 ) );
+	int symbolCount = 0;
+	for( int i=0; i<count; i++ ) {
+		for( int j=SAMPLER_SKIP_FRAMES; j<samples[i].depth; j++ ) {
+			symbols[symbolCount++].pc = framePC( &samples[i], j );
+		}
+	}
+	qsort( symbols, symbolCount, sizeof(SymbolEntry), pcCompare );
+	int unique = 0;
+	for( int i=0; i<symbolCount; i++ ) {
+		if( unique == 0 || symbols[i].pc != symbols[unique-1].pc ) {
+			symbols[unique].pc = symbols[i].pc;
+			symbols[unique].name = symbolName( symbols[i].pc );
+			unique++;
+		}
+	}
+
+	// FOLD each sample into "thread;root;...;leaf", then count equal lines
+	pthread_t *threads = (pthread_t *)malloc( sizeof(pthread_t) * ( count + 1 ) );
+	int threadCount = 0;
+	char **lines = (char **)malloc( sizeof(char *) * ( count + 1 ) );
+	int lineCount = 0;
+	char line[16384];
+	for( int i=0; i<count; i++ ) {
+		Sample *s = &samples[i];
+		if( s->depth <= SAMPLER_SKIP_FRAMES ) {
+			continue;
+		}
+		if( pthread_equal( s->thread, mainThread ) ) {
+			strcpy( line, "main" );
+		}
+		else {
+			int t;
+			for( t=0; t<threadCount && !pthread_equal( threads[t], s->thread ); t++ );
+			if( t == threadCount ) {
+				threads[threadCount++] = s->thread;
+			}
+			sprintf( line, "thread_%d", t+1 );
+		}
+		int len = (int)strlen( line );
+		for( int j=s->depth-1; j>=SAMPLER_SKIP_FRAMES; j-- ) {
+			SymbolEntry key;
+			key.pc = framePC( s, j );
+			SymbolEntry *sym = (SymbolEntry *)bsearch( &key, symbols, unique, sizeof(SymbolEntry), pcCompare );
+			int nameLen = (int)strlen( sym->name );
+			if( len + 1 + nameLen >= (int)sizeof(line) ) {
+				break;
+			}
+			line[len++] = ';';
+			memcpy( line + len, sym->name, nameLen + 1 );
+			len += nameLen;
+		}
+		lines[lineCount++] = strdup( line );
+	}
+	qsort( lines, lineCount, sizeof(char *), stringCompare );
+
+	int written = 0;
+	for( int i=0; i<lineCount; ) {
+		int j = i+1;
+		while( j < lineCount && !strcmp( lines[i], lines[j] ) ) {
+			j++;
+		}
+		fprintf( f, "%s %d\n", lines[i], j-i );
+		written += j-i;
+		i = j;
+	}
+	fclose( f );
+
+	// FREE
+	for( int i=0; i<lineCount; i++ ) {
+		free( lines[i] );
+	}
+	for( int i=0; i<unique; i++ ) {
+		free( symbols[i].name );
+	}
+	free( lines );
+	free( threads );
+	free( symbols );
+
+	if( wasRunning ) {
+		resume();
+	}
+	return written;
+}
+
+#endif
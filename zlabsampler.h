@@ -0,0 +1,33 @@
+#ifndef ZLABSAMPLER_H
+#define ZLABSAMPLER_H
+
+// Statistical CPU profiler.
+//
+// While running, a profiling timer interrupts whichever thread is using the
+// CPU (main or worker) at the requested rate and records its stack into a ring
+// of the most recent samples.  zlabSamplerDump() names the addresses and writes
+// the stacks in "folded" form, one line per distinct stack:
+//
+//   main;mainLoop();ZUI::zuiUpdate(double);...;leafFunction() 123
+//
+// which flamegraph.pl and speedscope read directly.  Functions are named from
+// the dynamic symbol table, so the Linux build exports all its symbols; anything
+// unnamed is written as module+offset.
+//
+// Not available on Windows, where start returns 0.
+
+int zlabSamplerStart( int hz, int maxSamples );
+	// Clears any earlier samples and starts sampling.  Returns 0 if unavailable.
+
+void zlabSamplerStop();
+
+int zlabSamplerIsRunning();
+
+int zlabSamplerSampleCount();
+	// Samples held, at most maxSamples
+
+int zlabSamplerDump( char *path );
+	// Writes folded stacks of the samples held; sampling pauses while it does.
+	// Returns the number of samples written, -1 if the file can't be written.
+
+#endif